@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// the tables and the arithmetic versions give identical results, the tables just trade branches for a memory load
+// set to 0 to use the arithmetic versions instead
+#ifndef COROGB_ALU_TABLES
+#define COROGB_ALU_TABLES 1
+#endif
+
+namespace coro_gb::alu
+{
+	// results are packed as the 8-bit value in the low byte and the carry flag in bit 8
+	// zero is always just (value == 0), so isn't stored
+
+	// DAA, adjusts A back into BCD after an add or subtract
+	constexpr uint16_t daa(uint8_t value, bool subtract, bool half_carry, bool carry)
+	{
+		uint8_t correction = 0;
+		if (half_carry || (!subtract && (value & 0x0F) > 0x09))
+		{
+			correction |= 0x06;
+		}
+		if (carry || (!subtract && value > 0x99))
+		{
+			correction |= 0x60;
+			carry = true;
+		}
+		value = subtract ? value - correction : value + correction;
+		return value | (carry << 8);
+	}
+
+	// CB-prefixed rotates and shifts (rlc, rrc, rl, rr, sla, sra, swap, srl)
+	// rlca, rrca, rla and rra are the same as ops 0-3, except that they always clear zero
+	constexpr uint16_t shift(uint8_t op, uint8_t value, bool carry)
+	{
+		switch (op & 0b111)
+		{
+			case 0b000: // rlc
+				carry = (value & 0b10000000) != 0;
+				value = (value << 1) | carry;
+				break;
+			case 0b001: // rrc
+				carry = (value & 0b00000001) != 0;
+				value = (value >> 1) | (carry << 7);
+				break;
+			case 0b010: // rl
+			{
+				const bool new_carry = (value & 0b10000000) != 0;
+				value = (value << 1) | carry;
+				carry = new_carry;
+				break;
+			}
+			case 0b011: // rr
+			{
+				const bool new_carry = (value & 0b00000001) != 0;
+				value = (value >> 1) | (carry << 7);
+				carry = new_carry;
+				break;
+			}
+			case 0b100: // sla
+				carry = (value & 0b10000000) != 0;
+				value = (value << 1);
+				break;
+			case 0b101: // sra
+				carry = (value & 0b00000001) != 0;
+				value = (value & 0b10000000) | (value >> 1);
+				break;
+			case 0b110: // swap
+				carry = false;
+				value = (value << 4) | (value >> 4);
+				break;
+			case 0b111: // srl
+				carry = (value & 0b00000001) != 0;
+				value = (value >> 1);
+				break;
+		}
+		return value | (carry << 8);
+	}
+
+	// indexed by value | subtract << 8 | half_carry << 9 | carry << 10
+	inline constexpr std::array<uint16_t, 2048> daa_table = []()
+	{
+		std::array<uint16_t, 2048> table{};
+		for (uint16_t i = 0; i < table.size(); ++i)
+		{
+			table[i] = daa((uint8_t)i, (i >> 8) & 1, (i >> 9) & 1, (i >> 10) & 1);
+		}
+		return table;
+	}();
+
+	// indexed by value | carry << 8 | op << 9
+	inline constexpr std::array<uint16_t, 4096> shift_table = []()
+	{
+		std::array<uint16_t, 4096> table{};
+		for (uint16_t i = 0; i < table.size(); ++i)
+		{
+			table[i] = shift((uint8_t)(i >> 9), (uint8_t)i, (i >> 8) & 1);
+		}
+		return table;
+	}();
+
+	__forceinline uint16_t run_daa(uint8_t value, bool subtract, bool half_carry, bool carry)
+	{
+#if COROGB_ALU_TABLES
+		return daa_table[value | subtract << 8 | half_carry << 9 | carry << 10];
+#else
+		return daa(value, subtract, half_carry, carry);
+#endif
+	}
+
+	__forceinline uint16_t run_shift(uint8_t op, uint8_t value, bool carry)
+	{
+#if COROGB_ALU_TABLES
+		return shift_table[value | carry << 8 | op << 9];
+#else
+		return shift(op, value, carry);
+#endif
+	}
+
+	// known results from hardware, checked against both versions
+	static_assert(daa(0x9A, false, false, false) == 0x100);             // 0x9A -> 0x00, carry
+	static_assert(daa(0x0F, false, false, false) == 0x015);             // 0x0F -> 0x15
+	static_assert(daa(0x15, false, true, false) == 0x01B);              // half carry adds 6
+	static_assert(daa(0xFA, true, true, true) == 0x194);                // both borrows subtract 0x66, carry sticks
+	static_assert(shift(0b000, 0x80, false) == 0x101);                  // rlc wraps bit 7 into bit 0 and carry
+	static_assert(shift(0b010, 0x80, false) == 0x100);                  // rl shifts in the old carry
+	static_assert(shift(0b011, 0x01, true) == 0x180);                   // rr
+	static_assert(shift(0b101, 0x81, false) == 0x1C0);                  // sra keeps the sign bit
+	static_assert(shift(0b110, 0xF1, true) == 0x01F);                   // swap clears carry
+
+	// every entry, looked up the way run_daa() and run_shift() index the tables
+	static_assert([]()
+	{
+		for (uint16_t value = 0; value < 256; ++value)
+		{
+			for (uint8_t flags = 0; flags < 8; ++flags)
+			{
+				const bool subtract = flags & 1, half_carry = (flags >> 1) & 1, carry = (flags >> 2) & 1;
+				if (daa_table[value | subtract << 8 | half_carry << 9 | carry << 10] != daa((uint8_t)value, subtract, half_carry, carry))
+				{
+					return false;
+				}
+			}
+			for (uint8_t op = 0; op < 8; ++op)
+			{
+				for (uint8_t carry = 0; carry < 2; ++carry)
+				{
+					if (shift_table[value | carry << 8 | op << 9] != shift(op, (uint8_t)value, carry))
+					{
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}());
+}
@@ -0,0 +1,63 @@
+#include "gb_breakpoints.h"
+#include "gb_cart.h"
+
+#include <algorithm>
+
+namespace coro_gb
+{
+	breakpoints::breakpoints(cycle_scheduler& scheduler)
+		: scheduler{ scheduler }
+	{
+	}
+
+	void breakpoints::add_pc(uint16_t bank, uint16_t address)
+	{
+		pc_locations.insert(make_location(address <= 0x7FFF ? bank : 0, address));
+		pc_addresses[address] = true;
+	}
+
+	void breakpoints::remove_pc(uint16_t bank, uint16_t address)
+	{
+		pc_locations.erase(make_location(address <= 0x7FFF ? bank : 0, address));
+
+		// the address filter only clears when no other bank has a breakpoint at this address
+		auto it = pc_locations.lower_bound(make_location(0, address));
+		pc_addresses[address] = std::any_of(it, pc_locations.end(), [address](uint32_t location) { return (location & 0xFFFF) == address; });
+	}
+
+	void breakpoints::add_cycle(uint32_t cycle)
+	{
+		scheduler.queue(cycle, cycle_scheduler::unit::debug, cycle_scheduler::priority::read,
+			[this, queued_generation = cycle_generation]() {
+				if (queued_generation == cycle_generation)
+				{
+					hit(break_reason::cycle, 0);
+				}
+			});
+	}
+
+	void breakpoints::clear()
+	{
+		pc_locations.clear();
+		pc_addresses.reset();
+		// queued cycle breakpoints can't be removed from the scheduler, so just make them do nothing
+		++cycle_generation;
+		software = false;
+	}
+
+	void breakpoints::hit(break_reason reason, uint16_t address)
+	{
+		last_hit = { reason, get_bank(address), address, scheduler.get_cycle_counter() };
+		scheduler.request_exit();
+	}
+
+	bool breakpoints::is_pc_hit_in_bank(uint16_t address) const
+	{
+		return pc_locations.contains(make_location(get_bank(address), address));
+	}
+
+	uint16_t breakpoints::get_bank(uint16_t address) const
+	{
+		return (address <= 0x7FFF && breakpoint_cart) ? breakpoint_cart->get_rom_bank(address) : 0;
+	}
+}
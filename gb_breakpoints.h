@@ -0,0 +1,98 @@
+#pragma once
+
+#include "gb_cycle_scheduler.h"
+
+#include <bitset>
+#include <cstdint>
+#include <set>
+#include <utility>
+
+namespace coro_gb
+{
+	struct cart;
+
+	enum class break_reason : uint8_t
+	{
+		none,
+		pc,       // about to execute an instruction at an armed bank:address
+		cycle,    // reached an armed cycle count
+		software, // executed ld b,b (mooneye's "debug break") with software breakpoints enabled
+	};
+
+	struct break_info final
+	{
+		break_reason reason = break_reason::none;
+		// bank:address of the instruction for pc and software breakpoints
+		uint16_t bank = 0;
+		uint16_t address = 0;
+		uint32_t cycle = 0;
+	};
+
+	// hitting a breakpoint ends the current emu::tick() early, with the cpu stopped just before the instruction
+	// pc and software breakpoints are checked by the cpu, but only while one is armed - otherwise the cpu doesn't even see this
+	// cycle breakpoints are events on the scheduler's debug unit, so cost nothing until they fire
+	struct breakpoints final
+	{
+		breakpoints(cycle_scheduler& scheduler);
+
+		void set_cart(const cart* in_cart)
+		{
+			breakpoint_cart = in_cart;
+		}
+
+		// bank is ignored for addresses outside of rom
+		void add_pc(uint16_t bank, uint16_t address);
+		void remove_pc(uint16_t bank, uint16_t address);
+		void add_cycle(uint32_t cycle);
+		void set_software(bool enabled)
+		{
+			software = enabled;
+		}
+		void clear();
+
+		// true if the cpu needs to check pc / software breakpoints at all
+		bool is_armed() const
+		{
+			return !pc_locations.empty() || software;
+		}
+		bool is_software_enabled() const
+		{
+			return software;
+		}
+		bool is_pc_hit(uint16_t address) const
+		{
+			// cheap test on the address alone first, the bank is only looked up on a match
+			return pc_addresses[address] && is_pc_hit_in_bank(address);
+		}
+
+		void hit(break_reason reason, uint16_t address);
+
+		bool has_hit() const
+		{
+			return last_hit.reason != break_reason::none;
+		}
+		// returns and clears the last breakpoint hit
+		break_info take_hit()
+		{
+			return std::exchange(last_hit, {});
+		}
+
+	protected:
+		bool is_pc_hit_in_bank(uint16_t address) const;
+		uint16_t get_bank(uint16_t address) const;
+
+		// locations are bank << 16 | address
+		static constexpr uint32_t make_location(uint16_t bank, uint16_t address)
+		{
+			return (uint32_t)bank << 16 | address;
+		}
+
+		cycle_scheduler& scheduler;
+		const cart* breakpoint_cart = nullptr;
+		std::set<uint32_t> pc_locations;
+		std::bitset<0x10000> pc_addresses;
+		uint32_t cycle_generation = 0; // invalidates cycle breakpoints queued before a clear()
+		bool software = false;
+		break_info last_hit;
+	};
+}
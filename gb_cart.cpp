@@ -43,6 +43,25 @@ namespace coro_gb
 		reset = true;
 	}
 
+	uint16_t cart::get_rom_bank(uint16_t address) const
+	{
+		if (address <= 0x7FFF && mbc->mapped_to)
+		{
+			// found by where the mapping points into the rom, which works the same for every mbc
+			const uint8_t* data = mbc->mapped_to->get_read_data(address);
+			if (data >= mbc->rom.data() && data < mbc->rom.data() + mbc->rom.size())
+			{
+				return (uint16_t)((data - mbc->rom.data()) / 0x4000);
+			}
+		}
+		return 0;
+	}
+
+	const std::vector<uint8_t>& cart::get_rom() const
+	{
+		return mbc->rom;
+	}
+
 	uint32_t get_ram_size(uint8_t ram_size_code)
 	{
 		switch (ram_size_code)
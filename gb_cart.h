@@ -16,6 +16,11 @@ namespace coro_gb
 		void map(memory_mapper& in_memory_mapper);
 		void unmap();
 
+		// the rom bank currently mapped at address (0x0000-0x7FFF), as numbered in a .sym file
+		uint16_t get_rom_bank(uint16_t address) const;
+
+		const std::vector<uint8_t>& get_rom() const;
+
 	protected:
 		void load_rom(std::filesystem::path in_rom_path);
 		void load_ram(std::filesystem::path in_ram_path);
@@ -0,0 +1,141 @@
+#include "gb_coverage.h"
+#include "gb_recompiled.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace coro_gb
+{
+	namespace
+	{
+		constexpr char coverage_magic[8] = { 'C', 'G', 'B', 'C', 'O', 'V', '1', '\0' };
+
+		uint8_t instruction_length(uint8_t opcode)
+		{
+			switch (opcode)
+			{
+				case 0x01: case 0x08: case 0x11: case 0x21: case 0x31: // ld rr,d16 / ld (a16),sp
+				case 0xC2: case 0xC3: case 0xC4: case 0xCA: case 0xCC: case 0xCD: // jp / call
+				case 0xD2: case 0xD4: case 0xDA: case 0xDC:
+				case 0xEA: case 0xFA: // ld (a16),a / ld a,(a16)
+					return 3;
+				case 0x10: // stop
+				case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // jr
+				case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // alu d8
+				case 0xE0: case 0xF0: case 0xE8: case 0xF8: // ldh / add sp / ld hl,sp+
+				case 0xCB:
+					return 2;
+				default:
+					return (opcode & 0b11000111) == 0b00000110 ? 2 : 1; // ld r,d8
+			}
+		}
+	}
+
+	coverage::coverage(const memory_mapper& in_memory, const std::vector<uint8_t>& in_rom)
+		: memory{ in_memory }
+		, rom{ in_rom }
+		, spare{ (in_rom.size() + 7) & ~size_t{ 7 } }
+		, executed(spare / 8 + 1)
+		, branches(spare / 4 + 1)
+	{
+	}
+
+	coverage::header coverage::make_header() const
+	{
+		header result{};
+		std::memcpy(result.magic, coverage_magic, sizeof(result.magic));
+		result.rom_hash = hash_rom(rom);
+		result.rom_size = rom.size();
+		return result;
+	}
+
+	void coverage::save(const std::filesystem::path& coverage_path)
+	{
+		const header expected = make_header();
+		const size_t executed_size = spare / 8;
+		const size_t branches_size = spare / 4;
+
+		// merge in earlier runs, the spare bytes past the end aren't saved
+		if (std::ifstream in{ coverage_path, std::ios::binary })
+		{
+			header existing;
+			std::vector<uint8_t> bits(executed_size + branches_size);
+			if (in.read(reinterpret_cast<char*>(&existing), sizeof(existing)) &&
+				std::memcmp(&existing, &expected, sizeof(header)) == 0 &&
+				in.read(reinterpret_cast<char*>(bits.data()), bits.size()))
+			{
+				for (size_t i = 0; i < executed_size; ++i)
+				{
+					executed[i] |= bits[i];
+				}
+				for (size_t i = 0; i < branches_size; ++i)
+				{
+					branches[i] |= bits[executed_size + i];
+				}
+			}
+		}
+
+		std::ofstream out{ coverage_path, std::ios::binary | std::ios::trunc };
+		out.write(reinterpret_cast<const char*>(&expected), sizeof(expected));
+		out.write(reinterpret_cast<const char*>(executed.data()), executed_size);
+		out.write(reinterpret_cast<const char*>(branches.data()), branches_size);
+		if (!out)
+		{
+			throw std::runtime_error("failed to write " + coverage_path.string());
+		}
+	}
+
+	void coverage::write_report(std::ostream& out) const
+	{
+		struct bank_totals final
+		{
+			size_t code_bytes = 0;
+			size_t both_ways = 0;
+			size_t one_way = 0;
+		};
+
+		auto write_line = [&out](const std::string& name, const bank_totals& totals, size_t bank_size)
+		{
+			out << std::setw(6) << name
+				<< std::setw(12) << totals.code_bytes
+				<< std::setw(8) << std::fixed << std::setprecision(1) << 100.0 * totals.code_bytes / bank_size << '%'
+				<< std::setw(11) << totals.both_ways
+				<< std::setw(10) << totals.one_way << '\n';
+		};
+
+		out << "  bank  code bytes  of bank  both ways  one way\n";
+		bank_totals rom_totals;
+		for (size_t bank_start = 0; bank_start < rom.size(); bank_start += 0x4000)
+		{
+			const size_t bank_end = std::min(bank_start + 0x4000, rom.size());
+			bank_totals totals;
+			for (size_t offset = bank_start; offset < bank_end; ++offset)
+			{
+				if (!((executed[offset >> 3] >> (offset & 7)) & 1))
+				{
+					continue;
+				}
+				// instructions that overlap others (jumps into the middle of one) are counted twice, which is rare enough to ignore
+				totals.code_bytes += std::min<size_t>(instruction_length(rom[offset]), bank_end - offset);
+				const uint8_t directions = (branches[offset >> 2] >> ((offset & 3) * 2)) & 0b11;
+				totals.both_ways += directions == 0b11;
+				totals.one_way += std::popcount(directions) == 1;
+			}
+
+			std::ostringstream name;
+			name << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << bank_start / 0x4000;
+			write_line(name.str(), totals, bank_end - bank_start);
+			rom_totals.code_bytes += totals.code_bytes;
+			rom_totals.both_ways += totals.both_ways;
+			rom_totals.one_way += totals.one_way;
+		}
+		write_line("total", rom_totals, rom.size());
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "gb_memory_mapper.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <vector>
+
+namespace coro_gb
+{
+	// which rom code has run: a bit per executed instruction, and two per conditional branch for the directions it went
+	// bits are indexed by offset into the rom (bank * 0x4000 + address in the bank), so they line up whichever bank was mapped at the time
+	// saving merges with the file from earlier runs of the same rom, see tools/recompiler.cpp for using it to seed recompilation
+	struct coverage final
+	{
+		coverage(const memory_mapper& memory, const std::vector<uint8_t>& rom);
+
+		// called by the cpu before each instruction
+		void record_instruction(uint16_t address)
+		{
+			// anything not in rom (ram, the boot rom) is recorded in a spare bit past the end rather than branched around
+			const uintptr_t offset = reinterpret_cast<uintptr_t>(memory.get_read_data(address)) - reinterpret_cast<uintptr_t>(rom.data());
+			current = offset < rom.size() ? offset : spare;
+			executed[current >> 3] |= 1 << (current & 7);
+		}
+
+		// called by the cpu for conditional jumps, calls and returns, after record_instruction()
+		void record_branch(bool taken)
+		{
+			branches[current >> 2] |= 1 << ((current & 3) * 2 + taken);
+		}
+
+		// merged with the file first if it's from the same rom
+		void save(const std::filesystem::path& coverage_path);
+
+		// per bank: bytes of code run, and conditional branches seen going both ways or only one
+		void write_report(std::ostream& out) const;
+
+	protected:
+		struct header final
+		{
+			char magic[8];
+			uint64_t rom_hash;
+			uint64_t rom_size;
+		};
+
+		header make_header() const;
+
+		const memory_mapper& memory;
+		const std::vector<uint8_t>& rom;
+		size_t spare; // rom size rounded up to a whole byte of either bitmap
+		size_t current = 0;
+		std::vector<uint8_t> executed; // 1 bit per rom byte
+		std::vector<uint8_t> branches; // 2 bits per rom byte, not taken then taken
+	};
+}
@@ -1,30 +1,60 @@
 #include "gb_cpu.h"
+#include "gb_alu_tables.h"
+#include "gb_breakpoints.h"
 #include "gb_cycle_scheduler.h"
 #include "gb_memory_mapper.h"
+#include "gb_recompiled.h"
+#include "gb_tracer.h"
 #include "single_future.h"
 
 namespace coro_gb
 {
-	cpu::cpu(cycle_scheduler& scheduler, memory_mapper& memory)
+	cpu_base::cpu_base(cycle_scheduler& scheduler, memory_mapper& memory)
 		: scheduler(scheduler),
 		memory(memory)
 	{
 	}
 
+	cpu::cpu(cycle_scheduler& scheduler, memory_mapper& memory)
+		: cpu_base(scheduler, memory)
+	{
+	}
+
 	cycle_scheduler::awaitable_cycles cpu::cycles(cycle_scheduler::priority priority, uint32_t wait)
 	{
 		return scheduler.cycles(cycle_scheduler::unit::cpu, priority, wait);
 	}
 
+#if COROGB_OPCODE_STATS
+	// a wait suspends the cpu unless it can complete straight away, see cycle_scheduler::awaitable_cycles_base::await_ready()
+#define record_wait(kind, wait) \
+	if (opcode_counter) \
+	{ \
+		opcode_counter->count_wait(opcode_stats::wait_kind::kind, wait, \
+			!scheduler.is_exclusive_until(cycle_scheduler::unit::cpu, cycle_scheduler::priority::kind, wait + additional_cycles)); \
+	}
+#define record_dummy_wait(wait) \
+	if (opcode_counter) \
+	{ \
+		opcode_counter->count_wait(opcode_stats::wait_kind::dummy, wait, false); \
+	}
+#else
+#define record_wait(kind, wait)
+#define record_dummy_wait(wait)
+#endif
+
 	// we add any dummy/additional cycles on to the next wait for efficiency
 #define dummy_wait(wait) \
+	record_dummy_wait(wait) \
 	additional_cycles += wait;
 
 #define read_wait(wait) \
+	record_wait(read, wait) \
 	co_await cycles(cycle_scheduler::priority::read, wait + additional_cycles); \
 	additional_cycles = 0;
 
 #define write_wait(wait) \
+	record_wait(write, wait) \
 	co_await cycles(cycle_scheduler::priority::write, wait + additional_cycles); \
 	additional_cycles = 0;
 
@@ -38,12 +68,12 @@ namespace coro_gb
 
 #define cpu_read16(var, address) \
 	cpu_read8(var, uint16_t, address); \
-	co_await cycles(cycle_scheduler::priority::read, 4); \
+	read_wait(4); \
 	var |= static_cast<uint16_t>(memory.read8(address + 1)) << 8;
 
 #define cpu_write16(address, value) \
 	cpu_write8(address, (value) & 0xFF); \
-	co_await cycles(cycle_scheduler::priority::write, 4); \
+	write_wait(4); \
 	memory.write8(address + 1, (value) >> 8);
 
 #define cpu_read8_pc(var, cast) \
@@ -59,44 +89,316 @@ namespace coro_gb
 	dummy_wait(4) \
 	write_wait(4); \
 	memory.write8(registers.SP--, (value) >> 8); \
-	co_await cycles(cycle_scheduler::priority::write, 4); \
+	write_wait(4); \
 	memory.write8(registers.SP, (value) & 0xFF);
 
 #define cpu_pop16(var) \
 	read_wait(4); \
 	var = memory.read8(registers.SP++); \
-	co_await cycles(cycle_scheduler::priority::read, 4); \
+	read_wait(4); \
 	var |= static_cast<uint16_t>(memory.read8(registers.SP++)) << 8;
 
-	struct alu_result
+	// wram, its mirror and hram can't be observed by the ppu or dma, so the cpu can touch them early without anyone noticing
+	static bool is_cpu_private(uint16_t first, uint16_t last)
+	{
+		return (first >= 0xC000 && last <= 0xFDFF) || (first >= 0xFF80 && last <= 0xFFFE);
+	}
+
+	// i/o registers (and ie) have side effects or change over time, so can only be touched by the real instructions
+	static bool is_io(uint16_t first, uint16_t last)
 	{
-		uint8_t value;
-		registers_t::flags flags;
-	};
+		return last >= 0xFEA0 && (first <= 0xFF7F || last == 0xFFFF);
+	}
+
+	uint32_t cpu_base::run_loop_idiom(uint8_t opcode)
+	{
+		// a pc breakpoint inside the loop would be skipped over, as would the trace of every iteration and the coverage of its taken branch
+		if (is_instruction_hooked())
+		{
+			return 0;
+		}
+
+		// ld (hl+),a / ld (hl-),a / ld a,(hl+) / ld a,(de)
+		if (opcode != 0x22 && opcode != 0x32 && opcode != 0x2A && opcode != 0x1A)
+		{
+			return 0;
+		}
+
+		const uint16_t start = registers.PC - 1;
+		uint8_t code[6];
+		for (uint8_t i = 0; i < 6; ++i)
+		{
+			code[i] = memory.read8(start + i);
+		}
+
+		// the canonical loops are:
+		//   fill: ld (hl+/-),a; dec r; jr nz,-4
+		//   copy: ld a,(hl+); ld (de),a; inc de; dec r; jr nz,-6
+		//         ld a,(de); ld (hl+),a; inc de; dec r; jr nz,-6
+		const bool fill = (opcode == 0x22 || opcode == 0x32) && code[2] == 0x20 && code[3] == 0xFC;
+		const bool copy = ((opcode == 0x2A && code[1] == 0x12) || (opcode == 0x1A && code[1] == 0x22)) &&
+			code[2] == 0x13 && code[4] == 0x20 && code[5] == 0xFA;
+		if (!fill && !copy)
+		{
+			return 0;
+		}
+
+		const uint8_t loop_length = fill ? 4 : 6;
+		const uint32_t cycles_per_iteration = fill ? 24 : 40;
+		uint8_t* counter;
+		switch (code[loop_length - 3])
+		{
+			case 0x05:
+				counter = &registers.B;
+				break;
+			case 0x0D:
+				counter = &registers.C;
+				break;
+			case 0x15:
+				counter = &registers.D;
+				break;
+			case 0x1D:
+				counter = &registers.E;
+				break;
+			default:
+				return 0;
+		}
+		if (copy && counter != &registers.B && counter != &registers.C)
+		{
+			return 0;
+		}
+
+		// the last iteration is left to the real instructions, so the loop exits exactly as it would have
+		uint32_t iterations = (*counter == 0 ? 256 : *counter) - 1;
+		if (iterations == 0)
+		{
+			return 0;
+		}
+
+		uint16_t* source = copy ? (opcode == 0x2A ? &registers.HL : &registers.DE) : nullptr;
+		uint16_t* dest = copy ? (opcode == 0x2A ? &registers.DE : &registers.HL) : &registers.HL;
+		const int8_t step = opcode == 0x32 ? -1 : 1;
+		const uint16_t dest_first = step > 0 ? *dest : *dest - (iterations - 1);
+		const uint16_t dest_last = step > 0 ? *dest + (iterations - 1) : *dest;
+		const uint16_t source_first = source ? *source : 0;
+		const uint16_t source_last = source ? *source + (iterations - 1) : 0;
+		if (dest_last < dest_first || source_last < source_first || // wraps around the address space
+			(dest_first < start + loop_length && dest_last >= start) || // self-modifying
+			is_io(dest_first, dest_last) || is_io(source_first, source_last) ||
+			dest_first <= 0x7FFF || // mbc control
+			memory.is_video_write_logged(dest_first, dest_last)) // all of the writes would land on the first iteration's cycle
+		{
+			return 0;
+		}
+
+		const bool interrupts_possible = registers.enable_interrupts || registers.enable_interrupts_delay;
+		if (interrupts_possible ||
+			!is_cpu_private(dest_first, dest_last) ||
+			!(source_last <= 0x7FFF || is_cpu_private(source_first, source_last)) ||
+			scheduler.is_queued(cycle_scheduler::unit::dma))
+		{
+			// other units could observe the loop (or raise an interrupt part way through it)
+			// so only run the iterations that complete before any of them next gets to run
+			if (interrupts_possible && ((memory.interrupt_flag & memory.interrupt_enable).u8 & 0x1F) != 0)
+			{
+				return 0;
+			}
+			iterations = std::min(iterations, scheduler.exclusive_cycles(cycle_scheduler::unit::cpu) / cycles_per_iteration);
+			if (iterations == 0)
+			{
+				return 0;
+			}
+		}
+
+		for (uint32_t i = 0; i < iterations; ++i)
+		{
+			if (fill)
+			{
+				memory.write8(*dest, registers.A);
+			}
+			else
+			{
+				registers.A = memory.read8((*source)++);
+				memory.write8(*dest, registers.A);
+			}
+			*dest += step;
+		}
+		*counter -= (uint8_t)iterations;
+		registers.F.half_carry = ((*counter & 0xF) == 0xF);
+		registers.F.subtract = 1;
+		registers.F.zero = (*counter == 0);
+
+		return iterations * cycles_per_iteration;
+	}
 
-	__forceinline constexpr alu_result run_alu(uint8_t value_a, uint8_t value_b, bool subtract, bool carry_in)
+	uint32_t cpu_base::run_fused_pair(uint8_t opcode)
 	{
-		if (subtract)
+		// a pc breakpoint on the second instruction would be skipped over, as would its trace and coverage
+		if (is_instruction_hooked())
+		{
+			return 0;
+		}
+
+		// the pairs, as counted by tools/opcode_pairs.cpp:
+		//   inc/dec r; jr cc         delay and polling loops
+		//   alu a,n; jr cc           mostly cp n
+		//   ldh a,(n); alu a,n       reading a variable in hram and masking or comparing it
+		//   ld a,(hl+); ld (de),a    copies
+		const bool inc_dec = (opcode & 0b11000110) == 0b00000100 && (opcode & 0b00111000) != 0b00110000;
+		const bool alu = (opcode & 0b11000111) == 0b11000110;
+		const bool ldh = opcode == 0b11110000;
+		const bool copy = opcode == 0b00101010;
+		if (!inc_dec && !alu && !ldh && !copy)
+		{
+			return 0;
+		}
+
+		// only pairs in rom, which are read straight from the bank rather than through the memory_mapper a byte at a time
+		// the rest of the pair is at most 3 bytes, which mustn't run over the end of the bank
+		if (!memory.boot_rom_disable || registers.PC > 0x7FFF || (registers.PC & 0x3FFF) > 0x3FFD)
+		{
+			return 0;
+		}
+
+		// all of the pair's accesses are made up front and its cycles waited afterwards, which can't be told apart from the real thing
+		// as long as no other unit runs before the pair ends and none of the accesses are to i/o registers (div changes every cycle)
+		// nothing can raise an interrupt in that time either, so the check between the two instructions never dispatches one
+		// the rest of the first instruction, then 8 cycles for the second's interrupt check, fetch and its one access
+		const uint32_t pair_cycles = (alu || copy ? 4 : ldh ? 8 : 0) + 8;
+		if ((registers.enable_interrupts && ((memory.interrupt_flag & memory.interrupt_enable).u8 & 0x1F) != 0) ||
+			!scheduler.is_exclusive_until(cycle_scheduler::unit::cpu, cycle_scheduler::priority::read, pair_cycles))
+		{
+			return 0;
+		}
+
+		const uint8_t* const code = memory.get_read_data(registers.PC);
+		const uint8_t* const second = code + (alu || ldh);
+		const uint8_t second_opcode = second[0];
+		const bool second_jr = (second_opcode & 0b11100111) == 0b00100000;
+		const bool second_alu = (second_opcode & 0b11000111) == 0b11000110;
+		if (!(inc_dec || alu ? second_jr : ldh ? second_alu : second_opcode == 0b00010010))
 		{
-			carry_in = !carry_in;
-			value_b = ~value_b;
+			return 0;
 		}
-		alu_result result = {
-			.value = (uint8_t)(value_a + value_b + carry_in),
-			.flags = {
-				.padding = 0,
-				.carry = (value_a + value_b + carry_in > 0xFF),
-				.half_carry = ((value_a & 0x0F) + (value_b & 0x0F) + carry_in > 0x0F),
-				.subtract = subtract,
-				.zero = (result.value == 0),
+
+		const uint16_t ldh_address = 0xFF00 + code[0];
+		if ((ldh && is_io(ldh_address, ldh_address)) || (copy && (is_io(registers.HL, registers.HL) || is_io(registers.DE, registers.DE))) ||
+			(copy && memory.is_video_write_logged(registers.DE, registers.DE))) // the write would land at the start of the pair
+		{
+			return 0;
+		}
+
+		auto fused_alu = [this](uint8_t alu_opcode, uint8_t value)
+		{
+			switch ((alu_opcode >> 3) & 0b111)
+			{
+				case 0b000: // add
+				case 0b001: // adc
+				case 0b010: // sub
+				case 0b011: // sbc
+				{
+					const bool subtract = (alu_opcode >> 4) & 0b1;
+					const bool carry = ((alu_opcode >> 3) & 0b1) && registers.F.carry;
+					alu_result result = run_alu(registers.A, value, subtract, carry);
+					registers.A = result.value;
+					registers.F = result.flags;
+					return;
+				}
+				case 0b100: // and
+					registers.A &= value;
+					break;
+				case 0b101: // xor
+					registers.A ^= value;
+					break;
+				case 0b110: // or
+					registers.A |= value;
+					break;
+				case 0b111: // cp
+					registers.F = run_alu(registers.A, value, true, false).flags;
+					return;
 			}
+			// and/xor/or
+			registers.F.carry = 0;
+			registers.F.half_carry = ((alu_opcode >> 3) & 0b111) == 0b100;
+			registers.F.subtract = 0;
+			registers.F.zero = (registers.A == 0);
 		};
-		if (subtract)
+
+		if (inc_dec)
+		{
+			uint8_t* const registers8[8] = { &registers.B, &registers.C, &registers.D, &registers.E, &registers.H, &registers.L, nullptr, &registers.A };
+			uint8_t& r = *registers8[(opcode >> 3) & 0b111];
+			r += (opcode & 0b1) ? -1 : 1;
+			registers.F.half_carry = ((r & 0xF) == ((opcode & 0b1) ? 0xF : 0));
+			registers.F.subtract = (opcode & 0b1);
+			registers.F.zero = (r == 0);
+		}
+		else if (alu)
+		{
+			fused_alu(opcode, code[0]);
+		}
+		else if (ldh)
+		{
+			registers.A = memory.read8(ldh_address);
+		}
+		else
 		{
-			result.flags.carry = !result.flags.carry;
-			result.flags.half_carry = !result.flags.half_carry;
+			registers.A = memory.read8(registers.HL++);
 		}
-		return result;
+
+		// the top of the loop for the second instruction, with interrupts not due
+		if (!registers.enable_interrupts)
+		{
+			registers.enable_interrupts = registers.enable_interrupts_delay;
+		}
+		registers.PC += (alu || ldh) + 1;
+
+		if (second_jr)
+		{
+			const int8_t offset = (int8_t)second[1];
+			++registers.PC;
+			const bool expected = (second_opcode >> 3) & 0b1;
+			if ((second_opcode >> 4) & 0b1 ? registers.F.carry == expected : registers.F.zero == expected)
+			{
+				registers.PC += offset;
+				return pair_cycles + 4;
+			}
+		}
+		else if (second_alu)
+		{
+			fused_alu(second_opcode, second[1]);
+			++registers.PC;
+		}
+		else
+		{
+			memory.write8(registers.DE, registers.A);
+		}
+		return pair_cycles;
+	}
+
+	uint32_t cpu_base::run_recompiled(uint32_t additional_cycles)
+	{
+		// the boot rom is mapped over the cart, and everything that hooks instructions needs to see every one of them
+		if (!memory.boot_rom_disable || is_instruction_hooked()
+#if COROGB_CALL_PROFILER
+			|| call_profiler
+#endif
+			)
+		{
+			return additional_cycles;
+		}
+
+		// no point looking up a block that couldn't run even its shortest instruction
+		recompiled_context context{ *this, additional_cycles };
+		while (scheduler.is_exclusive_until(cycle_scheduler::unit::cpu, cycle_scheduler::priority::read, context.additional_cycles + 4))
+		{
+			const recompiled_function function = recompiled->find(registers.PC);
+			if (!function || !function(context))
+			{
+				break;
+			}
+		}
+		return context.additional_cycles;
 	}
 
 	single_future<void> cpu::run()
@@ -109,6 +411,11 @@ namespace coro_gb
 
 		while (true)
 		{
+			if (recompiled && !halt_bug)
+			{
+				additional_cycles = (int8_t)run_recompiled(additional_cycles);
+			}
+
 			// The cpu has one level of pipelining, where memory reads and instruction execution are overlapped
 			// The read/write macros above wait before completing the read/write on the first rising edge of the new M-cycle
 			// Effectively, before a wait we are still on the rising edge at the start of the previous M-cycle
@@ -118,7 +425,13 @@ namespace coro_gb
 			// so we just emulate all reads/writes as occuring on the first T-cycle of the new M-cycle
 
 			// handle interrupts
-			if (registers.enable_interrupts)
+			if (registers.enable_interrupts && scheduler.is_interrupt_free_until(2 + additional_cycles))
+			{
+				// the check is before the interrupt horizon, so nothing can be pending
+				// skip it and fold its wait into the opcode read
+				dummy_wait(2);
+			}
+			else if (registers.enable_interrupts)
 			{
 				// interrupts are checked on the 3rd T-cycle (2) of the last M-cycle of the prior instruction
 				read_wait(2);
@@ -174,8 +487,10 @@ namespace coro_gb
 					{
 						interrupt_dest = 0x00;
 					}
+					memory.update_interrupt_pending();
 
 					registers.PC = interrupt_dest;
+					profile_call();
 					dummy_wait(2); // realign to T-cycle 2 ready for CPU to read opcode
 				}
 			}
@@ -186,24 +501,48 @@ namespace coro_gb
 				registers.enable_interrupts = registers.enable_interrupts_delay;
 			}
 
-#if _DEBUG
-			static volatile uint16_t debug_break_PC = 0xFFFF;
-			if (registers.PC == debug_break_PC)
+			// a hit ends the tick, so the opcode fetch below only happens when the emu is next ticked
+			[[unlikely]]
+			if (armed_breakpoints && armed_breakpoints->is_pc_hit(registers.PC))
 			{
-				__debugbreak();
+				armed_breakpoints->hit(break_reason::pc, registers.PC);
 			}
-			static volatile uint32_t debug_break_cycle_counter = 0xFFFFFFFF;
-			if (scheduler.get_cycle_counter() >= debug_break_cycle_counter)
+
+			[[unlikely]]
+			if (instruction_tracer)
 			{
-				__debugbreak();
+				instruction_tracer->trace(registers, memory);
+			}
+
+			[[unlikely]]
+			if (coverage_recorder)
+			{
+				coverage_recorder->record_instruction(registers.PC);
 			}
-#endif
 
 			read_wait(2);
 			const uint8_t opcode = memory.read8(registers.PC);
+#if COROGB_OPCODE_STATS
+			if (opcode_counter)
+			{
+				opcode_counter->count_opcode(opcode);
+			}
+#endif
 			if (!halt_bug)
 			{
 				++registers.PC;
+
+				// memset/memcpy style loops are run in bulk, arriving back at this same opcode fetch for the final iteration
+				if (const uint32_t loop_cycles = run_loop_idiom(opcode))
+				{
+					co_await cycles(cycle_scheduler::priority::read, loop_cycles);
+				}
+				// as are common pairs of instructions, nothing else runs before the pair ends so its cycles are added to the next wait
+				else if (const uint32_t pair_cycles = run_fused_pair(opcode))
+				{
+					dummy_wait(pair_cycles);
+					continue;
+				}
 			}
 			else
 			{
@@ -222,7 +561,23 @@ namespace coro_gb
 							}
 							if (opcode == 0b00010000) // STOP
 							{
-								throw std::runtime_error("STOP not implemented"); // ???
+								// stop is followed by a padding byte, which is skipped
+								++registers.PC;
+
+								// stop resets DIV and halts the system clock (and with it the lcd) until a button is pressed
+								memory.write8(0xFF04, 0);
+								if (!memory.is_any_button_down())
+								{
+									stopped = true;
+									scheduler.request_exit();
+									while (!memory.is_any_button_down())
+									{
+										memory.interrupts.cpu_wake.reset();
+										co_await memory.interrupts.cpu_wake;
+									}
+									stopped = false;
+								}
+								continue;
 							}
 
 							if (opcode == 0b00001000) // ld (a16), sp
@@ -244,7 +599,7 @@ namespace coro_gb
 							if ((opcode & 0b11110111) == 0b00100000) // jr nz/z
 							{
 								cpu_read8_pc(int8_t offset, int8_t);
-								if (registers.F.zero == ((opcode >> 3) & 0b1))
+								if (record_branch(registers.F.zero == ((opcode >> 3) & 0b1)))
 								{
 									registers.PC += offset;
 									dummy_wait(4);
@@ -255,7 +610,7 @@ namespace coro_gb
 							if ((opcode & 0b11110111) == 0b00110000) // jr nc/c
 							{
 								cpu_read8_pc(int8_t offset, int8_t);
-								if (registers.F.carry == ((opcode >> 3) & 0b1))
+								if (record_branch(registers.F.carry == ((opcode >> 3) & 0b1)))
 								{
 									registers.PC += offset;
 									dummy_wait(4);
@@ -525,32 +880,9 @@ namespace coro_gb
 						case 0b111:
 							if ((opcode & 0b11100111) == 0b00000111) // RLC/RRC/RL/RR A
 							{
-								switch (opcode >> 3)
-								{
-									case 0b00:
-										registers.F.carry = (registers.A & 0b10000000) != 0;
-										registers.A = (registers.A << 1) | registers.F.carry;
-										break;
-									case 0b01:
-										registers.F.carry = (registers.A & 0b00000001) != 0;
-										registers.A = (registers.A >> 1) | (registers.F.carry << 7);
-										break;
-									case 0b10:
-									{
-										bool new_carry = (registers.A & 0b10000000) != 0;
-										registers.A = (registers.A << 1) | registers.F.carry;
-										registers.F.carry = new_carry;
-									}
-									break;
-									case 0b11:
-									{
-										bool new_carry = (registers.A & 0b00000001) != 0;
-										registers.A = (registers.A >> 1) | (registers.F.carry << 7);
-										registers.F.carry = new_carry;
-									}
-									break;
-								}
-
+								const uint16_t result = alu::run_shift(opcode >> 3, registers.A, registers.F.carry);
+								registers.A = (uint8_t)result;
+								registers.F.carry = result >> 8;
 								registers.F.half_carry = 0;
 								registers.F.subtract = 0;
 								registers.F.zero = 0;
@@ -558,22 +890,11 @@ namespace coro_gb
 							}
 							if (opcode == 0b00100111) // DAA
 							{
-								uint8_t correction = 0;
-								if (registers.F.half_carry ||
-									(!registers.F.subtract && (registers.A & 0x0f) > 0x09))
-								{
-									correction |= 0x06;
-								}
-								if (registers.F.carry ||
-									(!registers.F.subtract && (registers.A & 0xff) > 0x99))
-								{
-									correction |= 0x60;
-									registers.F.carry = true;
-								}
-								alu_result result = run_alu(registers.A, correction, registers.F.subtract, false);
-								registers.A = result.value;
-								registers.F.half_carry  = 0;
-								registers.F.zero = result.flags.zero;
+								const uint16_t result = alu::run_daa(registers.A, registers.F.subtract, registers.F.half_carry, registers.F.carry);
+								registers.A = (uint8_t)result;
+								registers.F.carry = result >> 8;
+								registers.F.half_carry = 0;
+								registers.F.zero = (registers.A == 0);
 								continue;
 							}
 							if (opcode == 0b00101111) // CPL
@@ -634,6 +955,12 @@ namespace coro_gb
 						}
 					}
 
+					if (opcode == 0b01000000 && armed_breakpoints && armed_breakpoints->is_software_enabled()) // ld b,b
+					{
+						armed_breakpoints->hit(break_reason::software, registers.PC - 1);
+						continue;
+					}
+
 					//if ((opcode & 0b11000000) == 0b01000000) // ld r8,r8
 					{
 						uint8_t value;
@@ -802,8 +1129,9 @@ namespace coro_gb
 							{
 								// conditional ret has an extra machine cycle delay while it checks the condition
 								dummy_wait(4);
-								if (registers.F.zero == ((opcode >> 3) & 0b1))
+								if (record_branch(registers.F.zero == ((opcode >> 3) & 0b1)))
 								{
+									profile_return();
 									cpu_pop16(registers.PC);
 									dummy_wait(4);
 								}
@@ -814,8 +1142,9 @@ namespace coro_gb
 							{
 								// conditional ret has an extra machine cycle delay while it checks the condition
 								dummy_wait(4);
-								if (registers.F.carry == ((opcode >> 3) & 0b1))
+								if (record_branch(registers.F.carry == ((opcode >> 3) & 0b1)))
 								{
+									profile_return();
 									cpu_pop16(registers.PC);
 									dummy_wait(4);
 								}
@@ -890,6 +1219,7 @@ namespace coro_gb
 
 							if (opcode == 0b11001001) // ret
 							{
+								profile_return();
 								cpu_pop16(registers.PC);
 								dummy_wait(4);
 								continue;
@@ -897,6 +1227,7 @@ namespace coro_gb
 
 							if (opcode == 0b11011001) // reti
 							{
+								profile_return();
 								cpu_pop16(registers.PC);
 								registers.enable_interrupts = true;
 								registers.enable_interrupts_delay = true;
@@ -922,7 +1253,7 @@ namespace coro_gb
 							{
 								uint16_t dest;
 								cpu_read16_pc(dest);
-								if (registers.F.zero == ((opcode >> 3) & 0b1))
+								if (record_branch(registers.F.zero == ((opcode >> 3) & 0b1)))
 								{
 									registers.PC = dest;
 									dummy_wait(4);
@@ -934,7 +1265,7 @@ namespace coro_gb
 							{
 								uint16_t dest;
 								cpu_read16_pc(dest);
-								if (registers.F.carry == ((opcode >> 3) & 0b1))
+								if (record_branch(registers.F.carry == ((opcode >> 3) & 0b1)))
 								{
 									registers.PC = dest;
 									dummy_wait(4);
@@ -1001,10 +1332,11 @@ namespace coro_gb
 							{
 								uint16_t dest;
 								cpu_read16_pc(dest);
-								if (registers.F.zero == ((opcode >> 3) & 0b1))
+								if (record_branch(registers.F.zero == ((opcode >> 3) & 0b1)))
 								{
 									cpu_push16(registers.PC);
 									registers.PC = dest;
+									profile_call();
 								}
 								continue;
 							}
@@ -1013,10 +1345,11 @@ namespace coro_gb
 							{
 								uint16_t dest;
 								cpu_read16_pc(dest);
-								if (registers.F.carry == ((opcode >> 3) & 0b1))
+								if (record_branch(registers.F.carry == ((opcode >> 3) & 0b1)))
 								{
 									cpu_push16(registers.PC);
 									registers.PC = dest;
+									profile_call();
 								}
 								continue;
 							}
@@ -1051,6 +1384,7 @@ namespace coro_gb
 								cpu_read16_pc(dest);
 								cpu_push16(registers.PC);
 								registers.PC = dest;
+								profile_call();
 								continue;
 							}
 							break;
@@ -1130,6 +1464,7 @@ namespace coro_gb
 							uint16_t dest = (opcode & 0b00111000);
 							cpu_push16(registers.PC);
 							registers.PC = dest;
+							profile_call();
 							continue;
 						}
 					}
@@ -1139,6 +1474,12 @@ namespace coro_gb
 			if (opcode == 0b11001011) // bit
 			{
 				cpu_read8_pc(const uint8_t bitop, uint8_t);
+#if COROGB_OPCODE_STATS
+				if (opcode_counter)
+				{
+					opcode_counter->count_cb_opcode(bitop);
+				}
+#endif
 
 				switch (bitop >> 6)
 				{
@@ -1174,48 +1515,9 @@ namespace coro_gb
 								break;
 						}
 
-						switch ((bitop >> 3) & 0b111)
-						{
-							case 0b000:
-								registers.F.carry = (value & 0b10000000) != 0;
-								value = (value << 1) | registers.F.carry;
-								break;
-							case 0b001:
-								registers.F.carry = (value & 0b00000001) != 0;
-								value = (value >> 1) | (registers.F.carry << 7);
-								break;
-							case 0b010:
-							{
-								bool new_carry = (value & 0b10000000) != 0;
-								value = (value << 1) | registers.F.carry;
-								registers.F.carry = new_carry;
-								break;
-							}
-							case 0b011:
-							{
-								bool new_carry = (value & 0b00000001) != 0;
-								value = (value >> 1) | (registers.F.carry << 7);
-								registers.F.carry = new_carry;
-								break;
-							}
-							case 0b100:
-								registers.F.carry = (value & 0b10000000) != 0;
-								value = (value << 1);
-								break;
-							case 0b101:
-								registers.F.carry = (value & 0b00000001) != 0;
-								value = (value & 0b10000000) | (value >> 1);
-								break;
-							case 0b110:
-								registers.F.carry = 0;
-								value = (value << 4) | (value >> 4);
-								break;
-							case 0b111:
-								registers.F.carry = (value & 0b00000001) != 0;
-								value = (value >> 1);
-								break;
-						}
-
+						const uint16_t result = alu::run_shift(bitop >> 3, value, registers.F.carry);
+						value = (uint8_t)result;
+						registers.F.carry = result >> 8;
 						registers.F.half_carry = 0;
 						registers.F.subtract = 0;
 						registers.F.zero = (value == 0);
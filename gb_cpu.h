@@ -1,15 +1,38 @@
 #pragma once
 
+#include "gb_coverage.h"
 #include "gb_cycle_scheduler.h"
 
 #include <cstdint>
 
+// build with COROGB_CALL_PROFILER=1 to have the cpu report calls and returns to the profiler's call graph
+#ifndef COROGB_CALL_PROFILER
+#define COROGB_CALL_PROFILER 0
+#endif
+
+#if COROGB_CALL_PROFILER
+#include "gb_profiler.h"
+#endif
+
+// build with COROGB_OPCODE_STATS=1 to have the coroutine cpu count every opcode and wait, see gb_opcode_stats.h
+#ifndef COROGB_OPCODE_STATS
+#define COROGB_OPCODE_STATS 0
+#endif
+
+#if COROGB_OPCODE_STATS
+#include "gb_opcode_stats.h"
+#endif
+
 template <typename T>
 struct single_future;
 
 namespace coro_gb
 {
 	struct memory_mapper;
+	struct profiler;
+	struct breakpoints;
+	struct tracer;
+	struct recompiled_code;
 
 	struct registers_t final
 	{
@@ -24,7 +47,7 @@ namespace coro_gb
 
 		union
 		{
-			uint16_t AF;
+			uint16_t AF = 0;
 			struct
 			{
 				flags F;
@@ -33,7 +56,7 @@ namespace coro_gb
 		};
 		union
 		{
-			uint16_t BC;
+			uint16_t BC = 0;
 			struct
 			{
 				uint8_t C;
@@ -42,7 +65,7 @@ namespace coro_gb
 		};
 		union
 		{
-			uint16_t DE;
+			uint16_t DE = 0;
 			struct
 			{
 				uint8_t E;
@@ -51,30 +74,190 @@ namespace coro_gb
 		};
 		union
 		{
-			uint16_t HL;
+			uint16_t HL = 0;
 			struct
 			{
 				uint8_t L;
 				uint8_t H;
 			};
 		};
-		uint16_t SP;
+		uint16_t SP = 0;
 		uint16_t PC = 0;
 		bool enable_interrupts = false;
 		bool enable_interrupts_delay = false;
 	};
 
-	struct cpu final
+	// state and helpers shared by the cpu backends (cpu and cpu_state_machine)
+	struct cpu_base
 	{
-		cpu(cycle_scheduler& scheduler, memory_mapper& memory);
+		cpu_base(cycle_scheduler& scheduler, memory_mapper& memory);
 
-		single_future<void> run();
+		bool is_stopped() const
+		{
+			return stopped;
+		}
+
+		uint16_t get_pc() const
+		{
+			return registers.PC;
+		}
+
+		// nullptr when no pc or software breakpoint is armed, so the cpu can skip checking them
+		void set_breakpoints(breakpoints* in_armed_breakpoints)
+		{
+			armed_breakpoints = in_armed_breakpoints;
+		}
+
+		void set_tracer(tracer* in_instruction_tracer)
+		{
+			instruction_tracer = in_instruction_tracer;
+		}
+
+		void set_coverage(coverage* in_coverage_recorder)
+		{
+			coverage_recorder = in_coverage_recorder;
+		}
+
+		// nullptr to only interpret
+		void set_recompiled_code(const recompiled_code* in_recompiled)
+		{
+			recompiled = in_recompiled;
+		}
+
+#if COROGB_CALL_PROFILER
+		void set_call_profiler(profiler* in_call_profiler)
+		{
+			call_profiler = in_call_profiler;
+		}
+#endif
+
+#if COROGB_OPCODE_STATS
+		// only the coroutine cpu counts, cpu_state_machine doesn't suspend
+		void set_opcode_stats(opcode_stats* in_opcode_counter)
+		{
+			opcode_counter = in_opcode_counter;
+		}
+#endif
 
 	protected:
+		friend struct recompiled_context;
+
 		registers_t registers;
 		cycle_scheduler& scheduler;
 		memory_mapper& memory;
+		bool stopped = false;
+		breakpoints* armed_breakpoints = nullptr;
+		tracer* instruction_tracer = nullptr;
+		coverage* coverage_recorder = nullptr;
+		const recompiled_code* recompiled = nullptr;
+#if COROGB_CALL_PROFILER
+		profiler* call_profiler = nullptr;
+#endif
+#if COROGB_OPCODE_STATS
+		opcode_stats* opcode_counter = nullptr;
+#endif
+
+		// loops, pairs and recompiled blocks run many instructions at once, so can't be used while anything needs to see every one
+		bool is_instruction_hooked() const
+		{
+			return armed_breakpoints || instruction_tracer || coverage_recorder
+#if COROGB_OPCODE_STATS
+				|| opcode_counter
+#endif
+				;
+		}
+
+		// calls are reported after the return address is pushed and returns before it's popped, so SP identifies the frame either way
+		void profile_call();
+		void profile_return();
+
+		// conditional jumps, calls and returns, passes taken straight through
+		bool record_branch(bool taken);
+
+		// runs all but the last iteration of a recognised memset/memcpy style loop starting at PC-1 in one go
+		// returns the number of cycles the skipped iterations would have taken, or 0 if the loop has to run normally
+		uint32_t run_loop_idiom(uint8_t opcode);
 
+		// runs the instruction whose opcode was just fetched together with the one after it, if they're one of the common pairs
+		// returns the number of cycles the pair takes, or 0 if they have to run normally
+		uint32_t run_fused_pair(uint8_t opcode);
+
+		// runs recompiled blocks for as long as there's one at PC, from the top of an instruction
+		// returns the dummy cycles left to add to the next wait
+		uint32_t run_recompiled(uint32_t additional_cycles);
+	};
+
+	// the coroutine cpu, each memory access co_awaits the scheduler
+	struct cpu final : cpu_base
+	{
+		cpu(cycle_scheduler& scheduler, memory_mapper& memory);
+
+		single_future<void> run();
+
+	protected:
 		cycle_scheduler::awaitable_cycles cycles(cycle_scheduler::priority priority, uint32_t wait);
 	};
+
+	////////////////////////////////////////////////////////////////
+
+	struct alu_result
+	{
+		uint8_t value;
+		registers_t::flags flags;
+	};
+
+	__forceinline constexpr alu_result run_alu(uint8_t value_a, uint8_t value_b, bool subtract, bool carry_in)
+	{
+		if (subtract)
+		{
+			carry_in = !carry_in;
+			value_b = ~value_b;
+		}
+		alu_result result = {
+			.value = (uint8_t)(value_a + value_b + carry_in),
+			.flags = {
+				.padding = 0,
+				.carry = (value_a + value_b + carry_in > 0xFF),
+				.half_carry = ((value_a & 0x0F) + (value_b & 0x0F) + carry_in > 0x0F),
+				.subtract = subtract,
+				.zero = (result.value == 0),
+			}
+		};
+		if (subtract)
+		{
+			result.flags.carry = !result.flags.carry;
+			result.flags.half_carry = !result.flags.half_carry;
+		}
+		return result;
+	}
+
+	__forceinline bool cpu_base::record_branch(bool taken)
+	{
+		[[unlikely]]
+		if (coverage_recorder)
+		{
+			coverage_recorder->record_branch(taken);
+		}
+		return taken;
+	}
+
+	__forceinline void cpu_base::profile_call()
+	{
+#if COROGB_CALL_PROFILER
+		if (call_profiler)
+		{
+			call_profiler->on_call(registers.PC, registers.SP);
+		}
+#endif
+	}
+
+	__forceinline void cpu_base::profile_return()
+	{
+#if COROGB_CALL_PROFILER
+		if (call_profiler)
+		{
+			call_profiler->on_return(registers.SP);
+		}
+#endif
+	}
 }
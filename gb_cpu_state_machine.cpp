@@ -0,0 +1,931 @@
+#include "gb_cpu_state_machine.h"
+#include "gb_alu_tables.h"
+#include "gb_breakpoints.h"
+#include "gb_cycle_scheduler.h"
+#include "gb_memory_mapper.h"
+#include "gb_recompiled.h"
+#include "gb_tracer.h"
+#include "single_future.h"
+
+namespace coro_gb
+{
+	// the waits below mirror the macros in gb_cpu.cpp: an access happens at the end of its wait,
+	// and dummy cycles are folded into the wait for the next access
+
+	cpu_state_machine::cpu_state_machine(cycle_scheduler& scheduler, memory_mapper& memory)
+		: cpu_base(scheduler, memory)
+	{
+	}
+
+	single_future<void> cpu_state_machine::run()
+	{
+		// The CPU has one dummy M cycle on reset
+		advance(begin_instruction(4));
+
+		co_await failed;
+		std::rethrow_exception(failure);
+	}
+
+	void cpu_state_machine::resume()
+	{
+		scheduler.resume_unit(cycle_scheduler::unit::cpu);
+		try
+		{
+			advance(step_mcycle());
+		}
+		catch (...)
+		{
+			fail();
+		}
+	}
+
+	void cpu_state_machine::advance(uint32_t wait)
+	{
+		// keep stepping for as long as nothing else needs to run in between, otherwise come back later
+		while (wait != 0)
+		{
+			if (!scheduler.try_wait(cycle_scheduler::unit::cpu, cycle_scheduler::priority::read, wait))
+			{
+				scheduler.queue(scheduler.get_cycle_counter() + wait, cycle_scheduler::unit::cpu, cycle_scheduler::priority::read, [this]() { resume(); });
+				return;
+			}
+			wait = step_mcycle();
+		}
+	}
+
+	void cpu_state_machine::wake()
+	{
+		try
+		{
+			if (current_state == state::halt)
+			{
+				// re-align to 4-cycle boundary, see cpu::run()
+				const uint32_t halt_total_cycles = scheduler.get_cycle_counter() - halt_start_cycles;
+				advance(begin_instruction(4 - (halt_total_cycles % 4)));
+			}
+			else if (!memory.is_any_button_down())
+			{
+				wait_for_wake();
+			}
+			else
+			{
+				stopped = false;
+				advance(begin_instruction(0));
+			}
+		}
+		catch (...)
+		{
+			fail();
+		}
+	}
+
+	uint32_t cpu_state_machine::wait_for_wake()
+	{
+		memory.interrupts.cpu_wake.reset();
+		memory.interrupts.cpu_wake.set_callback([this]() { wake(); });
+		return 0;
+	}
+
+	void cpu_state_machine::fail()
+	{
+		// resumes run(), which rethrows into its future
+		failure = std::current_exception();
+		failed.trigger();
+	}
+
+	uint32_t cpu_state_machine::step_mcycle()
+	{
+		switch (current_state)
+		{
+			case state::interrupt_check:
+				return check_interrupts();
+			case state::interrupt_dispatch:
+				return dispatch_interrupt();
+			case state::fetch:
+				return fetch();
+			case state::execute:
+				return execute();
+			default:
+				// halt and stop are only left through wake()
+				return 0;
+		}
+	}
+
+	uint32_t cpu_state_machine::begin_instruction(uint32_t dummy_cycles)
+	{
+		if (recompiled && !halt_bug)
+		{
+			dummy_cycles = run_recompiled(dummy_cycles);
+		}
+
+		if (registers.enable_interrupts)
+		{
+			if (scheduler.is_interrupt_free_until(2 + dummy_cycles))
+			{
+				// the check is before the interrupt horizon, so nothing can be pending, skip it
+				return begin_fetch(dummy_cycles + 2);
+			}
+
+			// interrupts are checked on the 3rd T-cycle (2) of the last M-cycle of the prior instruction
+			current_state = state::interrupt_check;
+			return dummy_cycles + 2;
+		}
+
+		registers.enable_interrupts = registers.enable_interrupts_delay;
+		return begin_fetch(dummy_cycles + 2);
+	}
+
+	uint32_t cpu_state_machine::begin_fetch(uint32_t dummy_cycles)
+	{
+		// a hit ends the tick, so the opcode fetch only happens when the emu is next ticked
+		[[unlikely]]
+		if (armed_breakpoints && armed_breakpoints->is_pc_hit(registers.PC))
+		{
+			armed_breakpoints->hit(break_reason::pc, registers.PC);
+		}
+
+		[[unlikely]]
+		if (instruction_tracer)
+		{
+			instruction_tracer->trace(registers, memory);
+		}
+
+		[[unlikely]]
+		if (coverage_recorder)
+		{
+			coverage_recorder->record_instruction(registers.PC);
+		}
+
+		current_state = state::fetch;
+		return dummy_cycles + 2;
+	}
+
+	uint32_t cpu_state_machine::check_interrupts()
+	{
+		triggered_interrupts = (memory.interrupt_flag & memory.interrupt_enable).u8;
+		if ((triggered_interrupts & 0x1F) == 0)
+		{
+			return begin_fetch(0);
+		}
+
+		registers.enable_interrupts = false;
+		registers.enable_interrupts_delay = false;
+
+		// realign to 4-cycle clock, discard pipelined opcode read, pre-decrement SP
+		registers.SP--;
+		current_state = state::interrupt_dispatch;
+		mcycle = 1;
+		return 2 + 4 + 4 + 4;
+	}
+
+	uint32_t cpu_state_machine::dispatch_interrupt()
+	{
+		switch (mcycle)
+		{
+			case 1:
+				memory.write8(registers.SP--, (registers.PC) >> 8);
+				return next_mcycle(2);
+			case 2:
+				// interrupts are re-checked
+				triggered_interrupts = (memory.interrupt_flag & memory.interrupt_enable).u8;
+				return next_mcycle(2);
+		}
+
+		memory.write8(registers.SP, (registers.PC) & 0xFF);
+
+		uint16_t interrupt_dest = 0x00; // interrupt bug!
+		for (uint8_t bit = 0; bit < 5; ++bit)
+		{
+			if (triggered_interrupts & (1 << bit))
+			{
+				interrupt_dest = 0x40 + bit * 8;
+				memory.interrupt_flag.u8 &= ~(1 << bit);
+				break;
+			}
+		}
+		memory.update_interrupt_pending();
+
+		registers.PC = interrupt_dest;
+		profile_call();
+		return begin_fetch(2); // realign to T-cycle 2 ready for CPU to read opcode
+	}
+
+	uint32_t cpu_state_machine::fetch()
+	{
+		opcode = memory.read8(registers.PC);
+		current_state = state::execute;
+		mcycle = 0;
+		if (!halt_bug)
+		{
+			++registers.PC;
+
+			// memset/memcpy style loops are run in bulk, arriving back at this same opcode for the final iteration
+			if (const uint32_t loop_cycles = run_loop_idiom(opcode))
+			{
+				return loop_cycles;
+			}
+			if (const uint32_t pair_cycles = run_fused_pair(opcode))
+			{
+				return begin_instruction(pair_cycles);
+			}
+		}
+		else
+		{
+			halt_bug = false;
+		}
+		return execute();
+	}
+
+	uint32_t cpu_state_machine::halt()
+	{
+		registers.enable_interrupts = registers.enable_interrupts_delay;
+
+		if (((memory.interrupt_flag & memory.interrupt_enable).u8 & 0x1F) == 0)
+		{
+			halt_start_cycles = scheduler.get_cycle_counter();
+			current_state = state::halt;
+			return wait_for_wake();
+		}
+
+		if (!registers.enable_interrupts)
+		{
+			// oh no!
+			halt_bug = true;
+		}
+		return begin_instruction(0);
+	}
+
+	bool cpu_state_machine::condition()
+	{
+		// nz, z, nc, c
+		const bool expected = (opcode >> 3) & 0b1;
+		return record_branch(((opcode >> 4) & 0b1) ? registers.F.carry == expected : registers.F.zero == expected);
+	}
+
+	uint8_t& cpu_state_machine::register8(uint8_t index)
+	{
+		// 6 is (hl), which the caller handles
+		switch (index & 0b111)
+		{
+			case 0:
+				return registers.B;
+			case 1:
+				return registers.C;
+			case 2:
+				return registers.D;
+			case 3:
+				return registers.E;
+			case 4:
+				return registers.H;
+			case 5:
+				return registers.L;
+			default:
+				return registers.A;
+		}
+	}
+
+	uint16_t& cpu_state_machine::register16(uint8_t index)
+	{
+		switch (index & 0b11)
+		{
+			case 0:
+				return registers.BC;
+			case 1:
+				return registers.DE;
+			case 2:
+				return registers.HL;
+			default:
+				return registers.SP;
+		}
+	}
+
+	void cpu_state_machine::alu(uint8_t operation, uint8_t value)
+	{
+		switch (operation & 0b111)
+		{
+			case 0b000: // add
+			case 0b001: // adc
+			case 0b010: // sub
+			case 0b011: // sbc
+			{
+				const bool subtract = (operation & 0b010) != 0;
+				const bool carry = (operation & 0b001) != 0 && registers.F.carry;
+				alu_result result = run_alu(registers.A, value, subtract, carry);
+				registers.A = result.value;
+				registers.F = result.flags;
+				break;
+			}
+			case 0b100: // and
+				registers.A &= value;
+				registers.F.carry = 0;
+				registers.F.half_carry = 1;
+				registers.F.subtract = 0;
+				registers.F.zero = (registers.A == 0);
+				break;
+			case 0b101: // xor
+				registers.A ^= value;
+				registers.F.carry = 0;
+				registers.F.half_carry = 0;
+				registers.F.subtract = 0;
+				registers.F.zero = (registers.A == 0);
+				break;
+			case 0b110: // or
+				registers.A |= value;
+				registers.F.carry = 0;
+				registers.F.half_carry = 0;
+				registers.F.subtract = 0;
+				registers.F.zero = (registers.A == 0);
+				break;
+			case 0b111: // cp
+				registers.F = run_alu(registers.A, value, true, false).flags;
+				break;
+		}
+	}
+
+	uint8_t cpu_state_machine::cb_operation(uint8_t value)
+	{
+		// everything but bit test, which doesn't write back
+		const uint8_t mask = 1 << ((cb_opcode >> 3) & 0b111);
+		switch (cb_opcode >> 6)
+		{
+			case 0b00: // rotates/shifts
+			{
+				const uint16_t result = alu::run_shift(cb_opcode >> 3, value, registers.F.carry);
+				registers.F.carry = result >> 8;
+				registers.F.half_carry = 0;
+				registers.F.subtract = 0;
+				registers.F.zero = ((uint8_t)result == 0);
+				return (uint8_t)result;
+			}
+			case 0b10: // bit reset
+				return value & ~mask;
+			default: // bit set
+				return value | mask;
+		}
+	}
+
+	void cpu_state_machine::bit_test(uint8_t value)
+	{
+		registers.F.zero = !(value & (1 << ((cb_opcode >> 3) & 0b111)));
+		registers.F.half_carry = 1;
+		registers.F.subtract = 0;
+	}
+
+	uint32_t cpu_state_machine::execute()
+	{
+		if (opcode == 0b11001011)
+		{
+			return execute_cb();
+		}
+
+		switch (opcode >> 6)
+		{
+			case 0b01:
+				if (opcode == 0b01110110) // halt
+				{
+					return halt();
+				}
+
+				if (opcode == 0b01000000 && armed_breakpoints && armed_breakpoints->is_software_enabled()) // ld b,b
+				{
+					armed_breakpoints->hit(break_reason::software, registers.PC - 1);
+					return begin_instruction(0);
+				}
+
+				if ((opcode & 0b111) == 6) // ld r8,(hl)
+				{
+					if (mcycle == 0)
+					{
+						return next_mcycle(4);
+					}
+					register8(opcode >> 3) = memory.read8(registers.HL);
+					return begin_instruction(0);
+				}
+
+				if (((opcode >> 3) & 0b111) == 6) // ld (hl),r8
+				{
+					if (mcycle == 0)
+					{
+						value8 = register8(opcode);
+						return next_mcycle(4);
+					}
+					memory.write8(registers.HL, value8);
+					return begin_instruction(0);
+				}
+
+				// ld r8,r8
+				register8(opcode >> 3) = register8(opcode);
+				return begin_instruction(0);
+
+			case 0b10: // alu a,r8
+				if ((opcode & 0b111) == 6)
+				{
+					if (mcycle == 0)
+					{
+						return next_mcycle(4);
+					}
+					alu(opcode >> 3, memory.read8(registers.HL));
+					return begin_instruction(0);
+				}
+				alu(opcode >> 3, register8(opcode));
+				return begin_instruction(0);
+		}
+
+		switch (opcode)
+		{
+			case 0x00: // nop
+				return begin_instruction(0);
+
+			case 0x10: // stop
+				// stop is followed by a padding byte, which is skipped
+				++registers.PC;
+
+				// stop resets DIV and halts the system clock (and with it the lcd) until a button is pressed
+				memory.write8(0xFF04, 0);
+				if (!memory.is_any_button_down())
+				{
+					stopped = true;
+					scheduler.request_exit();
+					current_state = state::stop;
+					return wait_for_wake();
+				}
+				return begin_instruction(0);
+
+			case 0x08: // ld (a16), sp
+				switch (mcycle)
+				{
+					case 0:
+						return next_mcycle(4);
+					case 1:
+						value16 = memory.read8(registers.PC);
+						return next_mcycle(4);
+					case 2:
+						value16 |= static_cast<uint16_t>(memory.read8(registers.PC + 1)) << 8;
+						registers.PC += 2;
+						return next_mcycle(4);
+					case 3:
+						memory.write8(value16, registers.SP & 0xFF);
+						return next_mcycle(4);
+				}
+				memory.write8(value16 + 1, registers.SP >> 8);
+				return begin_instruction(0);
+
+			case 0x18: // jr
+			case 0x20: case 0x28: case 0x30: case 0x38: // jr cc
+			{
+				if (mcycle == 0)
+				{
+					return next_mcycle(4);
+				}
+				const int8_t offset = static_cast<int8_t>(memory.read8(registers.PC));
+				++registers.PC;
+				if (opcode == 0x18 || condition())
+				{
+					registers.PC += offset;
+					return begin_instruction(4);
+				}
+				return begin_instruction(0);
+			}
+
+			case 0x01: case 0x11: case 0x21: case 0x31: // ld r16, m16
+				switch (mcycle)
+				{
+					case 0:
+						return next_mcycle(4);
+					case 1:
+						value16 = memory.read8(registers.PC);
+						return next_mcycle(4);
+				}
+				value16 |= static_cast<uint16_t>(memory.read8(registers.PC + 1)) << 8;
+				registers.PC += 2;
+				register16(opcode >> 4) = value16;
+				return begin_instruction(0);
+
+			case 0x09: case 0x19: case 0x29: case 0x39: // add hl, r16
+			{
+				const uint16_t value = register16(opcode >> 4);
+				const uint16_t original = registers.HL;
+				const uint32_t result32 = (uint32_t)original + value;
+				registers.HL = (uint16_t)result32;
+				registers.F.carry = result32 > 0xFFFF;
+				registers.F.half_carry = ((original & 0x0FFF) + (value & 0x0FFF)) > 0x0FFF;
+				registers.F.subtract = 0;
+				return begin_instruction(0);
+			}
+
+			case 0x02: case 0x12: case 0x22: case 0x32: // ld (r16), a
+			case 0x0A: case 0x1A: case 0x2A: case 0x3A: // ld a, (r16)
+				if (mcycle == 0)
+				{
+					switch ((opcode >> 4) & 0b11)
+					{
+						case 0:
+							value16 = registers.BC;
+							break;
+						case 1:
+							value16 = registers.DE;
+							break;
+						case 2:
+							value16 = registers.HL++;
+							break;
+						case 3:
+							value16 = registers.HL--;
+							break;
+					}
+					return next_mcycle(4);
+				}
+				if (opcode & 0b1000)
+				{
+					registers.A = memory.read8(value16);
+				}
+				else
+				{
+					memory.write8(value16, registers.A);
+				}
+				return begin_instruction(0);
+
+			case 0x03: case 0x13: case 0x23: case 0x33: // inc r16
+				++register16(opcode >> 4);
+				return begin_instruction(4);
+
+			case 0x0B: case 0x1B: case 0x2B: case 0x3B: // dec r16
+				--register16(opcode >> 4);
+				return begin_instruction(4);
+
+			case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: // inc r8
+			{
+				const uint8_t value = ++register8(opcode >> 3);
+				registers.F.half_carry = ((value & 0xF) == 0);
+				registers.F.subtract = 0;
+				registers.F.zero = (value == 0);
+				return begin_instruction(0);
+			}
+
+			case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: // dec r8
+			{
+				const uint8_t value = --register8(opcode >> 3);
+				registers.F.half_carry = ((value & 0xF) == 0xF);
+				registers.F.subtract = 1;
+				registers.F.zero = (value == 0);
+				return begin_instruction(0);
+			}
+
+			case 0x34: // inc (hl)
+			case 0x35: // dec (hl)
+				switch (mcycle)
+				{
+					case 0:
+						return next_mcycle(4);
+					case 1:
+						value8 = memory.read8(registers.HL);
+						value8 += (opcode == 0x34) ? 1 : -1;
+						return next_mcycle(4);
+				}
+				memory.write8(registers.HL, value8);
+				registers.F.half_carry = ((value8 & 0xF) == ((opcode == 0x34) ? 0 : 0xF));
+				registers.F.subtract = (opcode == 0x35);
+				registers.F.zero = (value8 == 0);
+				return begin_instruction(0);
+
+			case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E: // ld r8,m
+				switch (mcycle)
+				{
+					case 0:
+						return next_mcycle(4);
+					case 1:
+						value8 = memory.read8(registers.PC);
+						++registers.PC;
+						if (opcode == 0x36)
+						{
+							return next_mcycle(4);
+						}
+						register8(opcode >> 3) = value8;
+						return begin_instruction(0);
+				}
+				memory.write8(registers.HL, value8);
+				return begin_instruction(0);
+
+			case 0x07: case 0x0F: case 0x17: case 0x1F: // RLC/RRC/RL/RR A
+			{
+				const uint16_t result = alu::run_shift(opcode >> 3, registers.A, registers.F.carry);
+				registers.A = (uint8_t)result;
+				registers.F.carry = result >> 8;
+				registers.F.half_carry = 0;
+				registers.F.subtract = 0;
+				registers.F.zero = 0;
+				return begin_instruction(0);
+			}
+
+			case 0x27: // DAA
+			{
+				const uint16_t result = alu::run_daa(registers.A, registers.F.subtract, registers.F.half_carry, registers.F.carry);
+				registers.A = (uint8_t)result;
+				registers.F.carry = result >> 8;
+				registers.F.half_carry = 0;
+				registers.F.zero = (registers.A == 0);
+				return begin_instruction(0);
+			}
+
+			case 0x2F: // CPL
+				registers.A = ~registers.A;
+				registers.F.half_carry = 1;
+				registers.F.subtract = 1;
+				return begin_instruction(0);
+
+			case 0x37: // SCF
+				registers.F.carry = 1;
+				registers.F.half_carry = 0;
+				registers.F.subtract = 0;
+				return begin_instruction(0);
+
+			case 0x3F: // CCF
+				registers.F.carry = !registers.F.carry;
+				registers.F.half_carry = 0;
+				registers.F.subtract = 0;
+				return begin_instruction(0);
+
+			case 0xC0: case 0xC8: case 0xD0: case 0xD8: // ret cc
+			case 0xC9: // ret
+			case 0xD9: // reti
+				switch (mcycle)
+				{
+					case 0:
+						if (opcode == 0xC9 || opcode == 0xD9)
+						{
+							profile_return();
+							return next_mcycle(4);
+						}
+						// conditional ret has an extra machine cycle delay while it checks the condition
+						if (!condition())
+						{
+							return begin_instruction(4);
+						}
+						profile_return();
+						return next_mcycle(8);
+					case 1:
+						registers.PC = memory.read8(registers.SP++);
+						return next_mcycle(4);
+				}
+				registers.PC |= static_cast<uint16_t>(memory.read8(registers.SP++)) << 8;
+				if (opcode == 0xD9)
+				{
+					registers.enable_interrupts = true;
+					registers.enable_interrupts_delay = true;
+				}
+				return begin_instruction(4);
+
+			case 0xE0: // ld (0xFF00 + a8), a
+			case 0xF0: // ld a, (0xFF00 + a8)
+				switch (mcycle)
+				{
+					case 0:
+						return next_mcycle(4);
+					case 1:
+						value8 = memory.read8(registers.PC);
+						++registers.PC;
+						return next_mcycle(4);
+				}
+				if (opcode == 0xE0)
+				{
+					memory.write8(0xFF00 + value8, registers.A);
+				}
+				else
+				{
+					registers.A = memory.read8(0xFF00 + value8);
+				}
+				return begin_instruction(0);
+
+			case 0xE8: // add SP, m8
+			case 0xF8: // ld HL, SP+m8
+			{
+				if (mcycle == 0)
+				{
+					return next_mcycle(4);
+				}
+				const int8_t value = static_cast<int8_t>(memory.read8(registers.PC));
+				++registers.PC;
+				const uint16_t original = registers.SP;
+				const uint16_t result = (uint16_t)(original + value);
+				registers.F.carry = ((original & 0xFF) + (value & 0xFF)) > 0xFF;
+				registers.F.half_carry = ((original & 0x0F) + (value & 0x0F)) > 0x0F;
+				registers.F.subtract = 0;
+				registers.F.zero = 0;
+				if (opcode == 0xE8)
+				{
+					registers.SP = result;
+					return begin_instruction(8);
+				}
+				registers.HL = result;
+				return begin_instruction(4);
+			}
+
+			case 0xC1: case 0xD1: case 0xE1: case 0xF1: // pop
+				switch (mcycle)
+				{
+					case 0:
+						return next_mcycle(4);
+					case 1:
+						value16 = memory.read8(registers.SP++);
+						return next_mcycle(4);
+				}
+				value16 |= static_cast<uint16_t>(memory.read8(registers.SP++)) << 8;
+				if (opcode == 0xF1)
+				{
+					registers.AF = value16;
+					registers.F.padding = 0;
+				}
+				else
+				{
+					register16(opcode >> 4) = value16;
+				}
+				return begin_instruction(0);
+
+			case 0xE9: // jp HL
+				registers.PC = registers.HL;
+				return begin_instruction(0);
+
+			case 0xF9: // ld SP,HL
+				registers.SP = registers.HL;
+				return begin_instruction(0);
+
+			case 0xC2: case 0xCA: case 0xD2: case 0xDA: // jp cc
+			case 0xC3: // jp
+				switch (mcycle)
+				{
+					case 0:
+						return next_mcycle(4);
+					case 1:
+						value16 = memory.read8(registers.PC);
+						return next_mcycle(4);
+				}
+				value16 |= static_cast<uint16_t>(memory.read8(registers.PC + 1)) << 8;
+				registers.PC += 2;
+				if (opcode == 0xC3 || condition())
+				{
+					registers.PC = value16;
+					return begin_instruction(4);
+				}
+				return begin_instruction(0);
+
+			case 0xE2: // ld (0xFF00 + C), A
+				if (mcycle == 0)
+				{
+					return next_mcycle(4);
+				}
+				memory.write8(0xFF00 + registers.C, registers.A);
+				return begin_instruction(0);
+
+			case 0xF2: // ld A, (0xFF00 + C)
+				if (mcycle == 0)
+				{
+					return next_mcycle(4);
+				}
+				registers.A = memory.read8(0xFF00 + registers.C);
+				return begin_instruction(0);
+
+			case 0xEA: // ld (a16), A
+			case 0xFA: // ld A, (a16)
+				switch (mcycle)
+				{
+					case 0:
+						return next_mcycle(4);
+					case 1:
+						value16 = memory.read8(registers.PC);
+						return next_mcycle(4);
+					case 2:
+						value16 |= static_cast<uint16_t>(memory.read8(registers.PC + 1)) << 8;
+						registers.PC += 2;
+						return next_mcycle(4);
+				}
+				if (opcode == 0xEA)
+				{
+					memory.write8(value16, registers.A);
+				}
+				else
+				{
+					registers.A = memory.read8(value16);
+				}
+				return begin_instruction(0);
+
+			case 0xF3: // di
+				registers.enable_interrupts = false;
+				registers.enable_interrupts_delay = false;
+				return begin_instruction(0);
+
+			case 0xFB: // ei
+				registers.enable_interrupts_delay = true;
+				return begin_instruction(0);
+
+			case 0xC4: case 0xCC: case 0xD4: case 0xDC: // call cc
+			case 0xCD: // call a16
+				switch (mcycle)
+				{
+					case 0:
+						return next_mcycle(4);
+					case 1:
+						value16 = memory.read8(registers.PC);
+						return next_mcycle(4);
+					case 2:
+						value16 |= static_cast<uint16_t>(memory.read8(registers.PC + 1)) << 8;
+						registers.PC += 2;
+						if (opcode != 0xCD && !condition())
+						{
+							return begin_instruction(0);
+						}
+						registers.SP--;
+						return next_mcycle(8);
+					case 3:
+						memory.write8(registers.SP--, registers.PC >> 8);
+						return next_mcycle(4);
+				}
+				memory.write8(registers.SP, registers.PC & 0xFF);
+				registers.PC = value16;
+				profile_call();
+				return begin_instruction(0);
+
+			case 0xC5: case 0xD5: case 0xE5: case 0xF5: // push
+				switch (mcycle)
+				{
+					case 0:
+						value16 = (opcode == 0xF5) ? registers.AF : register16(opcode >> 4);
+						registers.SP--;
+						return next_mcycle(8);
+					case 1:
+						memory.write8(registers.SP--, value16 >> 8);
+						return next_mcycle(4);
+				}
+				memory.write8(registers.SP, value16 & 0xFF);
+				return begin_instruction(0);
+
+			case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // alu a,d8
+				if (mcycle == 0)
+				{
+					return next_mcycle(4);
+				}
+				value8 = memory.read8(registers.PC);
+				++registers.PC;
+				alu(opcode >> 3, value8);
+				return begin_instruction(0);
+
+			case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // rst
+				switch (mcycle)
+				{
+					case 0:
+						registers.SP--;
+						return next_mcycle(8);
+					case 1:
+						memory.write8(registers.SP--, registers.PC >> 8);
+						return next_mcycle(4);
+				}
+				memory.write8(registers.SP, registers.PC & 0xFF);
+				registers.PC = (opcode & 0b00111000);
+				profile_call();
+				return begin_instruction(0);
+		}
+
+		throw std::runtime_error("unknown opcode");
+	}
+
+	uint32_t cpu_state_machine::execute_cb()
+	{
+		switch (mcycle)
+		{
+			case 0:
+				return next_mcycle(4);
+			case 1:
+			{
+				cb_opcode = memory.read8(registers.PC);
+				++registers.PC;
+				if ((cb_opcode & 0b111) == 6)
+				{
+					return next_mcycle(4);
+				}
+
+				uint8_t& reg = register8(cb_opcode);
+				if ((cb_opcode >> 6) == 0b01) // bit test
+				{
+					bit_test(reg);
+				}
+				else
+				{
+					reg = cb_operation(reg);
+				}
+				return begin_instruction(0);
+			}
+			case 2:
+			{
+				const uint8_t value = memory.read8(registers.HL);
+				if ((cb_opcode >> 6) == 0b01) // bit test
+				{
+					bit_test(value);
+					return begin_instruction(0);
+				}
+				value8 = cb_operation(value);
+				return next_mcycle(4);
+			}
+		}
+
+		memory.write8(registers.HL, value8);
+		return begin_instruction(0);
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "gb_cpu.h"
+#include "gb_interrupt.h"
+
+#include <cstdint>
+#include <exception>
+
+namespace coro_gb
+{
+	// the same cpu as cpu::run(), written as an explicit state machine driven by scheduler callbacks instead of a coroutine
+	// step_mcycle() runs up to the next memory access (usually one M-cycle) and returns how long to wait until the one after
+	// timing is identical to the coroutine cpu, it exists to measure what the coroutine machinery costs: use emu_t<cpu_state_machine>
+	struct cpu_state_machine final : cpu_base
+	{
+		cpu_state_machine(cycle_scheduler& scheduler, memory_mapper& memory);
+
+		// the state machine runs itself from the scheduler, this future only completes to report an exception (like cpu::run())
+		single_future<void> run();
+
+	protected:
+		enum class state : uint8_t
+		{
+			interrupt_check,
+			interrupt_dispatch,
+			fetch,
+			execute,
+			halt, // waiting on cpu_wake
+			stop, // waiting on cpu_wake and a button
+		};
+
+		// returns the number of cycles until the next step, or 0 if waiting on cpu_wake
+		uint32_t step_mcycle();
+
+		void resume();
+		void advance(uint32_t wait);
+		void wake();
+		uint32_t wait_for_wake();
+		void fail();
+
+		// the top of cpu::run()'s loop, dummy_cycles are the trailing internal cycles of the previous instruction
+		uint32_t begin_instruction(uint32_t dummy_cycles);
+		uint32_t begin_fetch(uint32_t dummy_cycles);
+		uint32_t check_interrupts();
+		uint32_t dispatch_interrupt();
+		uint32_t fetch();
+		uint32_t execute();
+		uint32_t execute_cb();
+		uint32_t halt();
+
+		uint32_t next_mcycle(uint32_t wait)
+		{
+			++mcycle;
+			return wait;
+		}
+
+		bool condition();
+		uint8_t& register8(uint8_t index);
+		uint16_t& register16(uint8_t index);
+		void alu(uint8_t operation, uint8_t value);
+		uint8_t cb_operation(uint8_t value);
+		void bit_test(uint8_t value);
+
+		state current_state = state::fetch;
+		uint8_t opcode = 0;
+		uint8_t mcycle = 0; // within the current instruction, 0 is the opcode fetch
+		uint8_t cb_opcode = 0;
+		uint8_t value8 = 0;
+		uint16_t value16 = 0;
+		uint8_t triggered_interrupts = 0;
+		bool halt_bug = false;
+		uint32_t halt_start_cycles = 0;
+
+		interrupt failed;
+		std::exception_ptr failure;
+	};
+}
@@ -40,6 +40,22 @@ namespace coro_gb
 		cycle_counter = end;
 	}
 
+	bool cycle_scheduler::is_queued(unit unit) const noexcept
+	{
+		return std::any_of(queued.begin(), queued.end(),
+			[unit](const cycle_wait& wait) { return (uint8_t)wait.priority == (uint8_t)unit; });
+	}
+
+	bool cycle_scheduler::is_only_unit_until(unit unit, uint32_t wait) const noexcept
+	{
+		if ((int32_t)(end - cycle_counter) <= (int32_t)wait)
+		{
+			return false;
+		}
+		return std::none_of(queued.begin(), queued.end(),
+			[this, unit, wait](const cycle_wait& queued_wait) { return (uint8_t)queued_wait.priority != (uint8_t)unit && (int32_t)(queued_wait.wait_until - cycle_counter) <= (int32_t)wait; });
+	}
+
 	////////////////////////////////////////////////////////////////
 
 	void cycle_scheduler::awaitable_cycles_base::await_suspend(std::coroutine_handle<> handle) noexcept
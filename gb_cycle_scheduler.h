@@ -86,10 +86,81 @@ namespace coro_gb
 			return cycle_counter;
 		}
 
+		// true if the current unit would reach the given wait without any other unit (or the end of the tick) running first
+		// i.e. nothing outside the current unit can change state before then
+		bool is_exclusive_until(unit unit, priority priority, uint32_t wait) const noexcept
+		{
+			return current_unit == unit &&
+				std::make_tuple((int32_t)wait, ((uint16_t)priority << 8 | (uint8_t)unit))
+				< std::make_tuple((int32_t)(next - cycle_counter), next_priority);
+		}
+
+		// number of cycles the current unit can wait for without any other unit (or the end of the tick) running first
+		uint32_t exclusive_cycles(unit unit) const noexcept
+		{
+			if (current_unit != unit)
+			{
+				return 0;
+			}
+			return (uint32_t)std::max((int32_t)(next - cycle_counter) - 1, 0);
+		}
+
+		// the equivalent of co_await cycles() for units driven by queued functions rather than coroutines
+		// try_wait() completes the wait straight away if nothing else would run first (like await_ready)
+		// otherwise the unit queue()s its continuation, which must call resume_unit() before doing anything else (like await_resume)
+		bool try_wait(unit unit, priority priority, uint32_t wait) noexcept
+		{
+			if (is_exclusive_until(unit, priority, wait))
+			{
+				cycle_counter += wait;
+				return true;
+			}
+			return false;
+		}
+
+		void resume_unit(unit unit) noexcept
+		{
+			current_unit = unit;
+		}
+
+		// true if the given unit has anything waiting in the queue
+		bool is_queued(unit unit) const noexcept;
+
+		// the earliest cycle at which an interrupt could be raised, set by the units that raise them (only the ppu so far) each time they
+		// know when they next could, and whether an enabled interrupt is already pending (IF & IE), kept up to date by memory_mapper.
+		// the cpu skips its interrupt checks while neither could make one fire
+		void set_interrupt_horizon(uint32_t at) noexcept
+		{
+			interrupt_horizon = at;
+		}
+
+		void set_interrupt_pending(bool pending) noexcept
+		{
+			interrupt_pending = pending;
+		}
+
+		// true if no enabled interrupt is pending or can be raised before or on the cycle the given wait ends
+		bool is_interrupt_free_until(uint32_t wait) const noexcept
+		{
+			return !interrupt_pending && (int32_t)(interrupt_horizon - cycle_counter) > (int32_t)wait;
+		}
+
+		// true if no other unit has anything queued up to and including the given wait, and the tick doesn't end first
+		// unlike is_exclusive_until() the unit's own queued functions don't count, so nothing else can run unless the unit itself wakes it
+		bool is_only_unit_until(unit unit, uint32_t wait) const noexcept;
+
 		void queue(uint32_t at, unit unit, priority priority, std::function<void()> fn) noexcept;
 
 		void tick(uint32_t num_cycles) noexcept;
 
+		// ends the current tick early, at the current cycle
+		void request_exit() noexcept
+		{
+			end = cycle_counter;
+			next = cycle_counter;
+			next_priority = 0;
+		}
+
 	private:
 		struct cycle_wait final
 		{
@@ -126,6 +197,8 @@ namespace coro_gb
 		uint32_t next = 0;
 		uint16_t next_priority = 0;
 		uint32_t end = 0;
+		uint32_t interrupt_horizon = 0;
+		bool interrupt_pending = true; // until IF or IE are first written
 		utils::sorted< cycle_wait, std::vector<cycle_wait>, cycle_comparator> queued{ cycle_comparator{*this} };
 
 		friend awaitable_cycles;
@@ -144,14 +217,7 @@ namespace coro_gb
 
 	inline bool cycle_scheduler::awaitable_cycles_base::await_ready() noexcept
 	{
-		if (scheduler.current_unit == unit &&
-			std::make_tuple((int32_t)(wait_until - scheduler.cycle_counter), ((uint16_t)priority << 8 | (uint8_t)unit))
-			< std::make_tuple((int32_t)(scheduler.next - scheduler.cycle_counter), scheduler.next_priority))
-		{
-			scheduler.cycle_counter = wait_until;
-			return true;
-		}
-		return false;
+		return scheduler.try_wait(unit, priority, wait_until - scheduler.cycle_counter);
 	}
 
 	inline void cycle_scheduler::awaitable_cycles_base::await_resume() noexcept
@@ -4,7 +4,8 @@
 
 namespace coro_gb
 {
-	void emu::select_palette(palette_preset in_palette_preset)
+	template <typename cpu_t>
+	void emu_t<cpu_t>::select_palette(palette_preset in_palette_preset)
 	{
 		static const constexpr std::array<uint32_t, 4> palette_grey =
 		{
@@ -56,4 +57,7 @@ namespace coro_gb
 			break;
 		}
 	}
+
+	template struct emu_t<cpu>;
+	template struct emu_t<cpu_state_machine>;
 }
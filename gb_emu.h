@@ -1,25 +1,38 @@
 #pragma once
 
+#include "gb_breakpoints.h"
+#include "gb_coverage.h"
 #include "gb_cpu.h"
+#include "gb_cpu_state_machine.h"
 #include "gb_ppu.h"
 #include "gb_buttons.h"
 #include "gb_cycle_scheduler.h"
 #include "gb_memory_mapper.h"
 #include "single_future.h"
 #include "gb_cart.h"
+#include "gb_profiler.h"
+#include "gb_recompiled.h"
+#include "gb_tracer.h"
 
 #include <array>
 #include <chrono>
 #include <filesystem>
+#include <iosfwd>
+#include <optional>
 
 namespace coro_gb
 {
-	struct emu;
-
 	// 456 Cycles per line
 	// 70224 Cycles per frame (16.6ms / 59.73 Hz)
 	using cycles = std::chrono::duration<int64_t, std::ratio<1, 4'194'304>>;
 
+	enum class tick_result : uint8_t
+	{
+		completed,
+		stopped, // the cpu executed STOP, no time passes until a button is pressed
+		breakpoint, // a breakpoint was hit part way through the tick, see emu::take_break()
+	};
+
 	enum class palette_preset : uint8_t
 	{
 		grey,
@@ -29,10 +42,12 @@ namespace coro_gb
 		gbr,
 	};
 
-	struct emu final
+	// cpu_t selects the cpu backend, either the coroutine cpu or cpu_state_machine
+	template <typename cpu_t>
+	struct emu_t final
 	{
-		emu();
-		~emu();
+		emu_t();
+		~emu_t();
 
 		void start();
 
@@ -40,7 +55,9 @@ namespace coro_gb
 		void load_cart(cart& in_cart);
 
 		uint32_t get_cycle_counter() const;
-		void tick(uint32_t num_cycles);
+		tick_result tick(uint32_t num_cycles);
+		// the cpu executed STOP and no time passes until input() presses a button, see tick_result::stopped
+		bool is_stopped() const;
 
 		bool is_screen_enabled() const;
 		const uint8_t* get_screen_buffer() const;
@@ -50,26 +67,73 @@ namespace coro_gb
 
 		void input(button_id button, button_state state);
 
+		void start_profiler(uint32_t sample_period);
+		profiler& get_profiler();
+
+		// pc breakpoints are by rom bank, the bank is ignored for addresses outside of rom
+		void add_pc_breakpoint(uint16_t bank, uint16_t address);
+		void remove_pc_breakpoint(uint16_t bank, uint16_t address);
+		void add_cycle_breakpoint(uint32_t cycle);
+		// break on "ld b,b", as used by the mooneye test roms
+		void set_software_breakpoints(bool enabled);
+		void clear_breakpoints();
+		break_info take_break();
+
+		// instruction trace in gameboy-doctor format, lz4 compressed if the path ends in .lz4
+		void start_trace(const std::filesystem::path& trace_path);
+		void stop_trace();
+		bool is_tracing() const;
+
+		// which rom code has run, see gb_coverage.h
+		void start_coverage();
+		// saves merged with any earlier runs in the file, then writes a per-bank summary of the merged coverage to report
+		void stop_coverage(const std::filesystem::path& coverage_path, std::ostream& report);
+		bool is_recording_coverage() const;
+
+#if COROGB_OPCODE_STATS
+		// counts of opcodes and waits, only the coroutine cpu counts them
+		void start_opcode_stats();
+		// writes the session summary and then a line per frame
+		void stop_opcode_stats(std::ostream& report);
+		bool is_counting_opcodes() const;
+#endif
+
 	protected:
+		void update_armed_breakpoints();
+
 		cycle_scheduler scheduler;
 		memory_mapper memory_mapper;
-		cpu cpu;
+		cpu_t cpu;
 		ppu ppu;
+		profiler profiler;
+		breakpoints breakpoints;
+		std::optional<tracer> tracer;
+		std::optional<coverage> coverage;
+#if COROGB_OPCODE_STATS
+		std::optional<opcode_stats> opcode_stats;
+#endif
+		std::optional<recompiled_code> recompiled_code;
 		std::array<std::array<uint32_t, 4>, 3> palette;
 		cart* loaded_cart = nullptr;
 		single_future<void> cpu_running;
 		single_future<void> ppu_running;
 	};
 
-	inline emu::emu()
+	using emu = emu_t<cpu>;
+
+	template <typename cpu_t>
+	inline emu_t<cpu_t>::emu_t()
 		: memory_mapper{ scheduler }
 		, cpu{ scheduler, memory_mapper }
 		, ppu{ scheduler, memory_mapper }
+		, profiler{ scheduler, cpu }
+		, breakpoints{ scheduler }
 	{
 		select_palette(palette_preset::green);
 	}
 
-	inline emu::~emu()
+	template <typename cpu_t>
+	inline emu_t<cpu_t>::~emu_t()
 	{
 		if (loaded_cart)
 		{
@@ -78,7 +142,8 @@ namespace coro_gb
 		}
 	}
 
-	inline void emu::start()
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::start()
 	{
 		if (!loaded_cart)
 		{
@@ -88,24 +153,50 @@ namespace coro_gb
 		ppu_running = ppu.run();
 	}
 
-	inline void emu::load_boot_rom(std::filesystem::path boot_rom_path)
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::load_boot_rom(std::filesystem::path boot_rom_path)
 	{
 		memory_mapper.load_boot_rom(std::move(boot_rom_path));
 	}
 
-	inline void emu::load_cart(cart& in_cart)
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::load_cart(cart& in_cart)
 	{
 		loaded_cart = &in_cart;
 		in_cart.map(memory_mapper);
+		breakpoints.set_cart(&in_cart);
+
+		// coverage is of the previous cart's rom
+		cpu.set_coverage(nullptr);
+		coverage.reset();
+
+		// use the rom's recompiled code if it was built in (see tools/recompiler.cpp)
+		if (const recompiled_rom* rom = find_recompiled_rom(hash_rom(in_cart.get_rom())))
+		{
+			recompiled_code.emplace(*rom, in_cart);
+			cpu.set_recompiled_code(&*recompiled_code);
+		}
+		else
+		{
+			cpu.set_recompiled_code(nullptr);
+			recompiled_code.reset();
+		}
 	}
 
-	inline uint32_t emu::get_cycle_counter() const
+	template <typename cpu_t>
+	inline uint32_t emu_t<cpu_t>::get_cycle_counter() const
 	{
 		return scheduler.get_cycle_counter();
 	}
 
-	inline void emu::tick(uint32_t num_cycles)
+	template <typename cpu_t>
+	inline tick_result emu_t<cpu_t>::tick(uint32_t num_cycles)
 	{
+		if (cpu.is_stopped())
+		{
+			return tick_result::stopped;
+		}
+
 		scheduler.tick(num_cycles);
 
 		if (cpu_running.is_ready())
@@ -116,31 +207,207 @@ namespace coro_gb
 		{
 			ppu_running.get();
 		}
+
+		if (cpu.is_stopped())
+		{
+			return tick_result::stopped;
+		}
+		return breakpoints.has_hit() ? tick_result::breakpoint : tick_result::completed;
 	}
 
-	inline bool emu::is_screen_enabled() const
+	template <typename cpu_t>
+	inline bool emu_t<cpu_t>::is_stopped() const
 	{
-		return ppu.is_screen_enabled();
+		return cpu.is_stopped();
 	}
 
-	inline const uint8_t* emu::get_screen_buffer() const
+	template <typename cpu_t>
+	inline bool emu_t<cpu_t>::is_screen_enabled() const
+	{
+		return ppu.is_screen_enabled() && !cpu.is_stopped();
+	}
+
+	template <typename cpu_t>
+	inline const uint8_t* emu_t<cpu_t>::get_screen_buffer() const
 	{
 		return ppu.get_screen_buffer();
 	}
 
-	inline const uint32_t* emu::get_palette() const
+	template <typename cpu_t>
+	inline const uint32_t* emu_t<cpu_t>::get_palette() const
 	{
 		return reinterpret_cast<const uint32_t*>(palette.data());
 	}
 
-	inline void emu::set_display_callback(std::function<void()> display_callback)
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::set_display_callback(std::function<void()> display_callback)
 	{
+#if COROGB_OPCODE_STATS || COROGB_CALL_PROFILER
+		// frames end when the ppu displays them
+		display_callback = [this, display_callback = std::move(display_callback)]()
+		{
+#if COROGB_OPCODE_STATS
+			if (opcode_stats)
+			{
+				opcode_stats->end_frame();
+			}
+#endif
+#if COROGB_CALL_PROFILER
+			profiler.end_frame();
+#endif
+			display_callback();
+		};
+#endif
 		ppu.set_display_callback(std::move(display_callback));
 	}
 
-	inline void emu::input(button_id button, button_state state)
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::input(button_id button, button_state state)
 	{
 		memory_mapper.input(button, state);
 		memory_mapper.interrupts.cpu_wake.trigger();
 	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::start_profiler(uint32_t sample_period)
+	{
+		if (!loaded_cart)
+		{
+			throw std::runtime_error("no cart loaded!");
+		}
+		profiler.start(*loaded_cart, sample_period);
+#if COROGB_CALL_PROFILER
+		cpu.set_call_profiler(&profiler);
+#endif
+	}
+
+	template <typename cpu_t>
+	inline profiler& emu_t<cpu_t>::get_profiler()
+	{
+		return profiler;
+	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::add_pc_breakpoint(uint16_t bank, uint16_t address)
+	{
+		breakpoints.add_pc(bank, address);
+		update_armed_breakpoints();
+	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::remove_pc_breakpoint(uint16_t bank, uint16_t address)
+	{
+		breakpoints.remove_pc(bank, address);
+		update_armed_breakpoints();
+	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::add_cycle_breakpoint(uint32_t cycle)
+	{
+		breakpoints.add_cycle(cycle);
+	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::set_software_breakpoints(bool enabled)
+	{
+		breakpoints.set_software(enabled);
+		update_armed_breakpoints();
+	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::clear_breakpoints()
+	{
+		breakpoints.clear();
+		update_armed_breakpoints();
+	}
+
+	template <typename cpu_t>
+	inline break_info emu_t<cpu_t>::take_break()
+	{
+		return breakpoints.take_hit();
+	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::start_trace(const std::filesystem::path& trace_path)
+	{
+		stop_trace();
+		tracer.emplace(trace_path);
+		cpu.set_tracer(&*tracer);
+	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::stop_trace()
+	{
+		cpu.set_tracer(nullptr);
+		tracer.reset(); // flushes the rest of the trace
+	}
+
+	template <typename cpu_t>
+	inline bool emu_t<cpu_t>::is_tracing() const
+	{
+		return tracer.has_value();
+	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::start_coverage()
+	{
+		if (!loaded_cart)
+		{
+			throw std::runtime_error("no cart loaded!");
+		}
+		coverage.emplace(memory_mapper, loaded_cart->get_rom());
+		cpu.set_coverage(&*coverage);
+	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::stop_coverage(const std::filesystem::path& coverage_path, std::ostream& report)
+	{
+		cpu.set_coverage(nullptr);
+		if (coverage)
+		{
+			coverage->save(coverage_path);
+			coverage->write_report(report);
+			coverage.reset();
+		}
+	}
+
+	template <typename cpu_t>
+	inline bool emu_t<cpu_t>::is_recording_coverage() const
+	{
+		return coverage.has_value();
+	}
+
+#if COROGB_OPCODE_STATS
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::start_opcode_stats()
+	{
+		opcode_stats.emplace();
+		cpu.set_opcode_stats(&*opcode_stats);
+	}
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::stop_opcode_stats(std::ostream& report)
+	{
+		cpu.set_opcode_stats(nullptr);
+		if (opcode_stats)
+		{
+			opcode_stats->write_session_summary(report);
+			report << '\n';
+			opcode_stats->write_frame_summary(report);
+			opcode_stats.reset();
+		}
+	}
+
+	template <typename cpu_t>
+	inline bool emu_t<cpu_t>::is_counting_opcodes() const
+	{
+		return opcode_stats.has_value();
+	}
+#endif
+
+	template <typename cpu_t>
+	inline void emu_t<cpu_t>::update_armed_breakpoints()
+	{
+		cpu.set_breakpoints(breakpoints.is_armed() ? &breakpoints : nullptr);
+	}
 }
@@ -0,0 +1,341 @@
+#include "gb_lz4.h"
+
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+namespace coro_gb::lz4
+{
+	namespace
+	{
+		constexpr uint32_t frame_magic = 0x184D2204;
+		constexpr size_t min_match = 4;
+		constexpr size_t last_literals = 5;     // the last 5 bytes of a block are always literals
+		constexpr size_t match_find_limit = 12; // and no match can start in the last 12
+		constexpr size_t max_offset = 0xFFFF;
+		constexpr int hash_log = 16;
+
+		uint32_t read32(const uint8_t* data)
+		{
+			uint32_t value;
+			memcpy(&value, data, sizeof(value));
+			return value;
+		}
+
+		uint32_t hash(uint32_t sequence)
+		{
+			return (sequence * 2654435761u) >> (32 - hash_log);
+		}
+
+		uint8_t* write_length(uint8_t* dst, size_t length)
+		{
+			while (length >= 255)
+			{
+				*dst++ = 255;
+				length -= 255;
+			}
+			*dst++ = (uint8_t)length;
+			return dst;
+		}
+
+		uint8_t* write_sequence(uint8_t* dst, const uint8_t* literals, size_t literal_length, size_t offset, size_t match_length)
+		{
+			uint8_t* token = dst++;
+			*token = (uint8_t)(std::min<size_t>(literal_length, 15) << 4);
+			if (literal_length >= 15)
+			{
+				dst = write_length(dst, literal_length - 15);
+			}
+			memcpy(dst, literals, literal_length);
+			dst += literal_length;
+
+			// the last sequence in a block is literals only
+			if (match_length != 0)
+			{
+				*token |= (uint8_t)std::min<size_t>(match_length - min_match, 15);
+				*dst++ = (uint8_t)(offset & 0xFF);
+				*dst++ = (uint8_t)(offset >> 8);
+				if (match_length - min_match >= 15)
+				{
+					dst = write_length(dst, match_length - min_match - 15);
+				}
+			}
+			return dst;
+		}
+
+		// xxhash32, only needed for the 2 byte frame descriptor so this skips the 16+ byte path
+		uint32_t header_checksum(const uint8_t* data, size_t size)
+		{
+			constexpr uint32_t prime1 = 2654435761u;
+			constexpr uint32_t prime2 = 2246822519u;
+			constexpr uint32_t prime3 = 3266489917u;
+			constexpr uint32_t prime4 = 668265263u;
+			constexpr uint32_t prime5 = 374761393u;
+			auto rotl = [](uint32_t value, int bits) { return (value << bits) | (value >> (32 - bits)); };
+
+			uint32_t h = prime5 + (uint32_t)size;
+			for (; size >= 4; data += 4, size -= 4)
+			{
+				h = rotl(h + read32(data) * prime3, 17) * prime4;
+			}
+			for (; size > 0; ++data, --size)
+			{
+				h = rotl(h + *data * prime5, 11) * prime1;
+			}
+			h ^= h >> 15;
+			h *= prime2;
+			h ^= h >> 13;
+			h *= prime3;
+			h ^= h >> 16;
+			return (h >> 8) & 0xFF;
+		}
+
+		void write32(std::ostream& out, uint32_t value)
+		{
+			const uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+			out.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+		}
+
+		uint32_t read32(std::istream& in)
+		{
+			uint8_t bytes[4];
+			if (!in.read(reinterpret_cast<char*>(bytes), sizeof(bytes)))
+			{
+				throw std::runtime_error("truncated lz4 frame");
+			}
+			return read32(bytes);
+		}
+	}
+
+	size_t compress_block(const uint8_t* src, size_t src_size, uint8_t* dst, std::vector<uint32_t>& hash_table)
+	{
+		// positions are stored +1, so 0 is empty
+		hash_table.assign(size_t{ 1 } << hash_log, 0);
+
+		uint8_t* out = dst;
+		size_t anchor = 0;
+		if (src_size > match_find_limit)
+		{
+			const size_t match_limit = src_size - match_find_limit;
+			size_t pos = 0;
+			while (pos < match_limit)
+			{
+				const uint32_t sequence = read32(src + pos);
+				uint32_t& entry = hash_table[hash(sequence)];
+				const size_t candidate = entry;
+				entry = (uint32_t)pos + 1;
+
+				if (candidate == 0 || pos - (candidate - 1) > max_offset || read32(src + candidate - 1) != sequence)
+				{
+					// step faster the longer it's been since the last match, so incompressible data doesn't cost much
+					pos += 1 + ((pos - anchor) >> 6);
+					continue;
+				}
+
+				const size_t match = candidate - 1;
+				size_t match_length = min_match;
+				while (pos + match_length < src_size - last_literals && src[match + match_length] == src[pos + match_length])
+				{
+					++match_length;
+				}
+
+				out = write_sequence(out, src + anchor, pos - anchor, pos - match, match_length);
+				pos += match_length;
+				anchor = pos;
+			}
+		}
+
+		out = write_sequence(out, src + anchor, src_size - anchor, 0, 0);
+		return out - dst;
+	}
+
+	void decompress_block(const uint8_t* src, size_t src_size, std::vector<uint8_t>& dst)
+	{
+		const uint8_t* in = src;
+		const uint8_t* const end = src + src_size;
+		auto read_length = [&in, end](size_t length)
+		{
+			if (length == 15)
+			{
+				uint8_t extra;
+				do
+				{
+					if (in == end)
+					{
+						throw std::runtime_error("corrupt lz4 block");
+					}
+					extra = *in++;
+					length += extra;
+				} while (extra == 255);
+			}
+			return length;
+		};
+
+		while (in < end)
+		{
+			const uint8_t token = *in++;
+
+			const size_t literal_length = read_length(token >> 4);
+			if (literal_length > (size_t)(end - in))
+			{
+				throw std::runtime_error("corrupt lz4 block");
+			}
+			dst.insert(dst.end(), in, in + literal_length);
+			in += literal_length;
+			if (in == end)
+			{
+				break;
+			}
+
+			if (end - in < 2)
+			{
+				throw std::runtime_error("corrupt lz4 block");
+			}
+			const size_t offset = in[0] | in[1] << 8;
+			in += 2;
+			const size_t match_length = read_length(token & 0x0F) + min_match;
+			if (offset == 0 || offset > dst.size())
+			{
+				throw std::runtime_error("corrupt lz4 block");
+			}
+
+			// matches can overlap their own output (that's how runs are encoded), so copy forwards a byte at a time
+			const size_t from = dst.size() - offset;
+			dst.resize(dst.size() + match_length);
+			uint8_t* copy_to = dst.data() + dst.size() - match_length;
+			const uint8_t* copy_from = dst.data() + from;
+			for (size_t i = 0; i < match_length; ++i)
+			{
+				copy_to[i] = copy_from[i];
+			}
+		}
+	}
+
+	////////////////////////////////////////////////////////////////
+
+	frame_writer::frame_writer(std::ostream& out)
+		: out{ out }
+	{
+		// version 1, independent blocks, no checksums or content size, 4MiB max block size
+		const uint8_t descriptor[2] = { 0b01100000, 0b01110000 };
+		write32(out, frame_magic);
+		out.write(reinterpret_cast<const char*>(descriptor), sizeof(descriptor));
+		out.put((char)header_checksum(descriptor, sizeof(descriptor)));
+	}
+
+	void frame_writer::write(const uint8_t* data, size_t size)
+	{
+		if (size == 0)
+		{
+			return;
+		}
+		if (size > max_block_size)
+		{
+			throw std::runtime_error("lz4 block too large");
+		}
+
+		compressed.resize(compress_bound(size));
+		const size_t compressed_size = compress_block(data, size, compressed.data(), hash_table);
+		if (compressed_size < size)
+		{
+			write32(out, (uint32_t)compressed_size);
+			out.write(reinterpret_cast<const char*>(compressed.data()), compressed_size);
+		}
+		else
+		{
+			// high bit marks a block stored uncompressed
+			write32(out, (uint32_t)size | 0x80000000);
+			out.write(reinterpret_cast<const char*>(data), size);
+		}
+	}
+
+	void frame_writer::finish()
+	{
+		write32(out, 0);
+		out.flush();
+	}
+
+	////////////////////////////////////////////////////////////////
+
+	frame_reader::frame_reader(std::istream& in)
+		: in{ in }
+	{
+		if (read32(in) != frame_magic)
+		{
+			throw std::runtime_error("not an lz4 frame");
+		}
+
+		uint8_t descriptor[2];
+		if (!in.read(reinterpret_cast<char*>(descriptor), sizeof(descriptor)) || (descriptor[0] >> 6) != 0b01)
+		{
+			throw std::runtime_error("unsupported lz4 frame");
+		}
+		linked_blocks = (descriptor[0] & 0b00100000) == 0;
+		block_checksums = (descriptor[0] & 0b00010000) != 0;
+		const bool content_size = (descriptor[0] & 0b00001000) != 0;
+		content_checksum = (descriptor[0] & 0b00000100) != 0;
+		const bool dictionary_id = (descriptor[0] & 0b00000001) != 0;
+
+		// content size, dictionary id and the header checksum aren't needed
+		in.ignore((content_size ? 8 : 0) + (dictionary_id ? 4 : 0) + 1);
+	}
+
+	bool frame_reader::read(std::vector<uint8_t>& data)
+	{
+		if (finished)
+		{
+			return false;
+		}
+
+		const uint32_t block_size = read32(in);
+		if (block_size == 0)
+		{
+			in.ignore(content_checksum ? 4 : 0);
+			finished = true;
+			return false;
+		}
+
+		const bool uncompressed = (block_size & 0x80000000) != 0;
+		compressed.resize(block_size & 0x7FFFFFFF);
+		if (!in.read(reinterpret_cast<char*>(compressed.data()), compressed.size()))
+		{
+			throw std::runtime_error("truncated lz4 frame");
+		}
+		in.ignore(block_checksums ? 4 : 0);
+
+		// linked blocks can refer back up to 64KiB into the previous blocks' output
+		if (!linked_blocks)
+		{
+			window.clear();
+		}
+		else if (window.size() > max_offset)
+		{
+			window.erase(window.begin(), window.end() - max_offset);
+		}
+
+		const size_t previous_size = window.size();
+		if (uncompressed)
+		{
+			window.insert(window.end(), compressed.begin(), compressed.end());
+		}
+		else
+		{
+			window.reserve(previous_size + max_block_size);
+			decompress_block(compressed.data(), compressed.size(), window);
+		}
+		data.assign(window.begin() + previous_size, window.end());
+		return true;
+	}
+
+	bool is_frame(std::istream& in)
+	{
+		const std::streampos start = in.tellg();
+		uint8_t bytes[4];
+		const bool is_lz4 = in.read(reinterpret_cast<char*>(bytes), sizeof(bytes)) && read32(bytes) == frame_magic;
+		in.clear();
+		in.seekg(start);
+		return is_lz4;
+	}
+}
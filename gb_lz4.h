@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+// minimal lz4 (https://github.com/lz4/lz4/blob/dev/doc) block compressor and frame reader/writer
+// the output is a standard .lz4 frame, so can also be unpacked with the lz4 command line tool
+namespace coro_gb::lz4
+{
+	// largest block a frame_writer will accept, the output of a single block never exceeds this plus compress_bound()'s overhead
+	inline constexpr size_t max_block_size = 4 * 1024 * 1024;
+
+	constexpr size_t compress_bound(size_t size)
+	{
+		return size + size / 255 + 16;
+	}
+
+	// compresses src into dst (which must be at least compress_bound(src_size) bytes), returns the compressed size
+	// hash_table is scratch space, it's reset on every call so it can be reused between blocks
+	size_t compress_block(const uint8_t* src, size_t src_size, uint8_t* dst, std::vector<uint32_t>& hash_table);
+
+	// decompresses a block, appending to dst
+	// dst can already contain up to 64KiB of previous output, for frames with linked blocks
+	void decompress_block(const uint8_t* src, size_t src_size, std::vector<uint8_t>& dst);
+
+	struct frame_writer final
+	{
+		frame_writer(std::ostream& out);
+
+		// each call is written as one independent block
+		void write(const uint8_t* data, size_t size);
+		void finish();
+
+	protected:
+		std::ostream& out;
+		std::vector<uint8_t> compressed;
+		std::vector<uint32_t> hash_table;
+	};
+
+	struct frame_reader final
+	{
+		frame_reader(std::istream& in);
+
+		// replaces data with the next block's contents, returns false at the end of the frame
+		bool read(std::vector<uint8_t>& data);
+
+	protected:
+		std::istream& in;
+		std::vector<uint8_t> compressed;
+		std::vector<uint8_t> window; // previous output, for linked blocks
+		bool linked_blocks = false;
+		bool block_checksums = false;
+		bool content_checksum = false;
+		bool finished = false;
+	};
+
+	// true if the stream starts with the lz4 frame magic number, doesn't consume anything
+	bool is_frame(std::istream& in);
+}
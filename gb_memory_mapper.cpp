@@ -227,6 +227,7 @@ namespace coro_gb
 				else if (address == 0xFF0F)
 				{
 					interrupt_flag.u8 = 0xE0 | u8;
+					update_interrupt_pending();
 				}
 				else if (address <= 0xFF23)
 				{
@@ -281,6 +282,7 @@ namespace coro_gb
 			else if (address == 0xFFFF)
 			{
 				interrupt_enable.u8 = u8;
+				update_interrupt_pending();
 			}
 		}
 	}
@@ -300,11 +302,21 @@ namespace coro_gb
 		set_mapping({0x0000, 0x00FF, boot_rom.data(), nullptr });
 	}
 
+	void memory_mapper::update_interrupt_pending()
+	{
+		scheduler.set_interrupt_pending(((interrupt_flag & interrupt_enable).u8 & 0x1F) != 0);
+	}
+
 	void memory_mapper::input(button_id button, button_state state)
 	{
 		buttons[(uint8_t)button] = state;
 	}
 
+	bool memory_mapper::is_any_button_down() const
+	{
+		return std::find(std::begin(buttons), std::end(buttons), button_state::down) != std::end(buttons);
+	}
+
 	void memory_mapper::set_mapping(memory_mapper::mapping new_mapping)
 	{
 		auto it = std::lower_bound(mappings.begin(), mappings.end(), new_mapping);
@@ -319,6 +331,31 @@ namespace coro_gb
 		}
 	}
 
+	void memory_mapper::set_video_writes_logged(bool logged)
+	{
+		video_writes_logged = logged;
+	}
+
+	bool memory_mapper::is_video_write_logged(uint16_t first, uint16_t last) const
+	{
+		return video_writes_logged && ((first <= 0x9FFF && last >= 0x8000) || (first <= 0xFE9F && last >= 0xFE00));
+	}
+
+	const uint8_t* memory_mapper::get_read_data(uint16_t address) const
+	{
+		if (const mapping* mapping = find_mapping(address))
+		{
+			if (std::holds_alternative<uint8_t*>(mapping->read))
+			{
+				if (uint8_t* data = std::get<uint8_t*>(mapping->read))
+				{
+					return data + (address - mapping->start_address);
+				}
+			}
+		}
+		return nullptr;
+	}
+
 	const memory_mapper::mapping* memory_mapper::find_mapping(uint16_t address) const
 	{
 		//auto end = std::upper_bound(mappings.begin(), mappings.end(), address, [](uint16_t address, const mapping& mapping) { return address < mapping.start_address; });
@@ -26,8 +26,12 @@ namespace coro_gb
 
 		void load_boot_rom(std::filesystem::path boot_rom_path);
 
+		// tells the scheduler whether an enabled interrupt is pending, after interrupt_flag or interrupt_enable change other than by write8()
+		void update_interrupt_pending();
+
 	public:
 		void input(button_id button, button_state state);
+		bool is_any_button_down() const;
 
 		struct mapping
 		{
@@ -46,6 +50,14 @@ namespace coro_gb
 	public:
 		void set_mapping(mapping new_mapping);
 		void remove_mapping(mapping new_mapping);
+
+		// the backing memory currently mapped for reads at address, or nullptr if it isn't plain memory
+		const uint8_t* get_read_data(uint16_t address) const;
+
+		// while the ppu logs writes with the cycle they land on (see ppu::begin_line_write_log()), vram and oam have to be written
+		// on the cycle the instruction would write them, not ahead of time
+		void set_video_writes_logged(bool logged);
+		bool is_video_write_logged(uint16_t first, uint16_t last) const;
 	protected:
 		const mapping* find_mapping(uint16_t address) const;
 
@@ -64,6 +76,8 @@ namespace coro_gb
 		std::vector<uint8_t> boot_rom; // mapped at 0x0000 (over cartridge rom) until boot is complete
 		std::array<uint8_t, 8192> wram;
 
+		bool video_writes_logged = false;
+
 	public:
 		// 0xFF00 - 0xFF7F: Devices Mappings.Used to access I / O devices.
 
@@ -0,0 +1,173 @@
+#include "gb_opcode_stats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+
+namespace coro_gb
+{
+	namespace
+	{
+		constexpr const char* wait_kind_names[3] = { "read", "write", "dummy" };
+
+		const char* addressing_form(uint8_t opcode)
+		{
+			switch (opcode)
+			{
+				case 0x02: case 0x0A: case 0x12: case 0x1A:
+					return "(bc)/(de)";
+				case 0x22: case 0x2A: case 0x32: case 0x3A:
+					return "(hl+)/(hl-)";
+				case 0x34: case 0x35: case 0x36:
+					return "(hl)";
+				case 0x08: case 0xEA: case 0xFA:
+					return "(a16)";
+				case 0xE0: case 0xE2: case 0xF0: case 0xF2:
+					return "(ff00+n)/(ff00+c)";
+				case 0x01: case 0x11: case 0x21: case 0x31:
+					return "immediate 16";
+				case 0xE8: case 0xF8:
+					return "immediate 8";
+				case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+				case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9:
+					return "jump";
+				case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:
+					return "call";
+				case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9:
+					return "return";
+				default:
+					break;
+			}
+
+			if (opcode >= 0x40 && opcode <= 0xBF && opcode != 0x76)
+			{
+				// ld r,r' and alu a,r
+				return (opcode & 0b111) == 6 || (opcode >= 0x70 && opcode <= 0x77) ? "(hl)" : "register";
+			}
+			if ((opcode & 0b11000111) == 0b00000110 || (opcode & 0b11000111) == 0b11000110)
+			{
+				return "immediate 8"; // ld r,n and alu a,n
+			}
+			if ((opcode & 0b11000111) == 0b11000111)
+			{
+				return "call"; // rst
+			}
+			if ((opcode & 0b11001011) == 0b11000001)
+			{
+				return "stack"; // push/pop
+			}
+			if ((opcode & 0b11000110) == 0b00000100 || (opcode & 0b11000111) == 0b00000011 || (opcode & 0b11001111) == 0b00001001 || opcode == 0xF9)
+			{
+				return "register"; // inc/dec r, inc/dec rr, add hl,rr, ld sp,hl
+			}
+			return "implied";
+		}
+
+		template <typename T>
+		void write_percentage(std::ostream& out, T part, T whole)
+		{
+			out << std::setw(8) << std::fixed << std::setprecision(2) << (whole ? 100.0 * part / whole : 0.0) << '%';
+		}
+	}
+
+	void opcode_stats::end_frame()
+	{
+		frames.push_back(current);
+		current = {};
+	}
+
+	void opcode_stats::write_frame_summary(std::ostream& out) const
+	{
+		out << " frame  instructions  read waits (suspended)  write waits (suspended)  dummy cycles\n";
+		for (size_t i = 0; i < frames.size(); ++i)
+		{
+			const frame& frame = frames[i];
+			const wait_counts& reads = frame.waits[(size_t)wait_kind::read];
+			const wait_counts& writes = frame.waits[(size_t)wait_kind::write];
+			out << std::setw(6) << i
+				<< std::setw(14) << frame.instructions
+				<< std::setw(12) << reads.waits << std::setw(12) << reads.suspensions
+				<< std::setw(13) << writes.waits << std::setw(12) << writes.suspensions
+				<< std::setw(14) << frame.waits[(size_t)wait_kind::dummy].cycles << '\n';
+		}
+	}
+
+	void opcode_stats::write_session_summary(std::ostream& out) const
+	{
+		frame total = current;
+		for (const frame& frame : frames)
+		{
+			total.instructions += frame.instructions;
+			for (size_t kind = 0; kind < total.waits.size(); ++kind)
+			{
+				total.waits[kind].waits += frame.waits[kind].waits;
+				total.waits[kind].cycles += frame.waits[kind].cycles;
+				total.waits[kind].suspensions += frame.waits[kind].suspensions;
+			}
+		}
+
+		out << total.instructions << " instructions over " << frames.size() << " frames\n\n";
+
+		out << "wait        waits      cycles   suspended\n";
+		for (size_t kind = 0; kind < total.waits.size(); ++kind)
+		{
+			const wait_counts& counts = total.waits[kind];
+			out << std::left << std::setw(6) << wait_kind_names[kind] << std::right
+				<< std::setw(11) << counts.waits << std::setw(12) << counts.cycles;
+			write_percentage(out, counts.suspensions, counts.waits);
+			out << '\n';
+		}
+
+		std::map<std::string, uint64_t> form_counts;
+		for (size_t opcode = 0; opcode < opcodes.size(); ++opcode)
+		{
+			// cb-prefixed instructions are counted by the opcode after the prefix
+			if (opcode != 0xCB)
+			{
+				form_counts[addressing_form((uint8_t)opcode)] += opcodes[opcode];
+			}
+			form_counts[(opcode & 0b111) == 6 ? "cb (hl)" : "cb register"] += cb_opcodes[opcode];
+		}
+		std::vector<std::pair<std::string, uint64_t>> forms{ form_counts.begin(), form_counts.end() };
+		std::sort(forms.begin(), forms.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+		out << "\naddressing form             count\n";
+		for (const auto& [form, count] : forms)
+		{
+			if (count == 0)
+			{
+				break;
+			}
+			out << std::left << std::setw(20) << form << std::right << std::setw(14) << count;
+			write_percentage(out, count, total.instructions);
+			out << '\n';
+		}
+
+		std::vector<std::pair<uint16_t, uint64_t>> sorted;
+		for (size_t opcode = 0; opcode < opcodes.size(); ++opcode)
+		{
+			if (opcode != 0xCB)
+			{
+				sorted.push_back({ (uint16_t)opcode, opcodes[opcode] });
+			}
+			sorted.push_back({ (uint16_t)(0x100 | opcode), cb_opcodes[opcode] });
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+		out << "\nopcode          count\n";
+		for (const auto& [opcode, count] : sorted)
+		{
+			if (count == 0)
+			{
+				break;
+			}
+			out << (opcode & 0x100 ? "CB " : "   ") << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (opcode & 0xFF)
+				<< std::dec << std::setfill(' ') << std::setw(14) << count;
+			write_percentage(out, count, total.instructions);
+			out << '\n';
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+namespace coro_gb
+{
+	// counts of what the coroutine cpu spends its time on, built in with COROGB_OPCODE_STATS=1 (see gb_cpu.h)
+	// every opcode run (cb-prefixed ones separately), and every wait by kind: how many cycles it was for and whether it suspended the cpu
+	// so another unit could run, or completed straight away. dummy waits never suspend, they're added on to the next read or write
+	struct opcode_stats final
+	{
+		enum class wait_kind : uint8_t
+		{
+			read,
+			write,
+			dummy,
+		};
+
+		void count_opcode(uint8_t opcode)
+		{
+			++current.instructions;
+			++opcodes[opcode];
+		}
+
+		void count_cb_opcode(uint8_t opcode)
+		{
+			++cb_opcodes[opcode];
+		}
+
+		void count_wait(wait_kind kind, uint32_t cycles, bool suspended)
+		{
+			wait_counts& counts = current.waits[(size_t)kind];
+			++counts.waits;
+			counts.cycles += cycles;
+			counts.suspensions += suspended;
+		}
+
+		// called when the ppu finishes a frame
+		void end_frame();
+
+		// instructions and waits for each frame, one line per frame
+		void write_frame_summary(std::ostream& out) const;
+		// totals by wait kind, addressing form and opcode
+		void write_session_summary(std::ostream& out) const;
+
+	protected:
+		struct wait_counts final
+		{
+			uint64_t waits = 0;
+			uint64_t cycles = 0;
+			uint64_t suspensions = 0;
+		};
+
+		struct frame final
+		{
+			uint64_t instructions = 0;
+			std::array<wait_counts, 3> waits;
+		};
+
+		frame current;
+		std::vector<frame> frames;
+		std::array<uint64_t, 256> opcodes = {};
+		std::array<uint64_t, 256> cb_opcodes = {};
+	};
+}
@@ -3,11 +3,14 @@
 #include "gb_ppu.h"
 #include "gb_cycle_scheduler.h"
 #include "gb_memory_mapper.h"
+#include "gb_ppu_pixels.h"
 #include "single_future.h"
 
 #include <algorithm>
+#include <bit>
 #include <immintrin.h>
 #include <cassert>
+#include <tuple>
 
 namespace coro_gb
 {
@@ -16,7 +19,11 @@ namespace coro_gb
 		, memory{ memory }
 	{
 		// vram
-		memory.set_mapping({ 0x8000, 0x9FFF, vram.data(), vram.data() });
+		map_vram();
+		for (uint16_t row = 0; row < decoded_tiles.rows.size(); ++row)
+		{
+			decoded_tiles.decode_row(row, vram[row * 2], vram[row * 2 + 1]);
+		}
 
 		//oam
 		memory.set_mapping({ 0xFE00, 0xFEA0, (uint8_t*)oam.data(), (uint8_t*)oam.data() });
@@ -35,73 +42,136 @@ namespace coro_gb
 		return scheduler.interruptible_cycles(interrupts.lcd_enable, cycle_scheduler::unit::ppu, priority, wait);
 	}
 
-	static uint8_t flipx(uint8_t b) {
-		b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
-		b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
-		b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
-		return b;
+	namespace
+	{
+		// each bit of a tile data byte spread out to a byte of its own, bit 7 (the leftmost pixel) in the low byte or flipped
+		constexpr std::array<uint64_t, 256> make_spread_bits(bool flip)
+		{
+			std::array<uint64_t, 256> table{};
+			for (int bits = 0; bits < 256; ++bits)
+			{
+				for (int pixel = 0; pixel < 8; ++pixel)
+				{
+					if ((bits >> (flip ? pixel : 7 - pixel)) & 1)
+					{
+						table[bits] |= uint64_t{ 1 } << (pixel * 8);
+					}
+				}
+			}
+			return table;
+		}
+
+		constexpr std::array<uint64_t, 256> spread_bits = make_spread_bits(false);
+		constexpr std::array<uint64_t, 256> spread_bits_flipped = make_spread_bits(true);
+
+		// 0xFF in each byte of the row holding a non-zero colour
+		uint64_t opaque_mask(uint64_t row)
+		{
+			return ((row | (row >> 1)) & 0x0101010101010101) * 0xFF;
+		}
+	}
+
+	void ppu::decoded_tiles_t::decode_row(uint16_t row, uint8_t low_bits, uint8_t high_bits)
+	{
+		rows[row] = spread_bits[low_bits] | (spread_bits[high_bits] << 1);
+		flipped_rows[row] = spread_bits_flipped[low_bits] | (spread_bits_flipped[high_bits] << 1);
 	}
 
-	void ppu::fifo_t::apply_bg(uint8_t low_bits, uint8_t high_bits)
+	void ppu::fifo_t::apply_bg(uint64_t row)
 	{
 		//assert(bg_count == 0); // can happen when switching to window
 		bg_count = 8;
-		bg_colour0 = flipx(low_bits);
-		bg_colour1 = flipx(high_bits);
+		bg_pixels = row;
 	}
 
-	void ppu::fifo_t::apply_sprite(uint8_t low_bits, uint8_t high_bits, sprite_attributes::flags_t flags)
+	void ppu::fifo_t::apply_sprite(uint64_t row, sprite_attributes::flags_t flags)
 	{
-		if (!flags.flip_x)
-		{
-			low_bits = flipx(low_bits);
-			high_bits = flipx(high_bits);
-		}
+		// sprite pixels only go where there isn't one from an earlier sprite already
+		const uint64_t mask = opaque_mask(row) & ~opaque_mask(obj_pixels & 0x0303030303030303);
+		const uint64_t attributes = ((flags.palette ? obj_palette_bit : 0) | (flags.priority ? 0 : obj_priority_bit)) * 0x0101010101010101;
+
+		obj_pixels = (obj_pixels & ~mask) | ((row | attributes) & mask);
+	}
 
-		uint8_t obj_mask = (obj_colour0 | obj_colour1);
-		uint8_t mask = (low_bits | high_bits) & ~obj_mask;
+	void ppu::fifo_t::pop(uint8_t count, const palettes_t& palettes, uint8_t* out)
+	{
+		static_assert(obj_palette_bit == pixels::obj_palette_bit && obj_priority_bit == pixels::obj_priority_bit);
+		assert(count <= 8);
 
-		obj_colour0  = (obj_colour0  & ~mask) | (low_bits & mask);
-		obj_colour1  = (obj_colour1  & ~mask) | (high_bits & mask);
-		obj_palette  = (obj_palette  & ~mask) | (-flags.palette & mask);
-		obj_priority = (obj_priority & ~mask) | ((flags.priority-1) & mask);
+		pixels::compose(bg_pixels, obj_pixels, count, palettes.background_palette.u8, palettes.obj_palettes[0].u8, palettes.obj_palettes[1].u8, out);
+		discard(count);
 	}
 
-	uint8_t ppu::fifo_t::pop(const palettes_t& palettes)
+	void ppu::fifo_t::discard(uint8_t count)
 	{
-		assert(bg_count > 0);
-		--bg_count;
+		assert(bg_count >= count);
+		bg_count -= count;
+
+		bg_pixels  = count < 8 ? bg_pixels  >> (count * 8) : 0;
+		obj_pixels = count < 8 ? obj_pixels >> (count * 8) : 0;
+	}
 
-		const uint8_t bg_colour  = ((bg_colour1  & 1) << 1) | (bg_colour0  & 1);
-		const uint8_t obj_colour = ((obj_colour1 & 1) << 1) | (obj_colour0 & 1);
-		const uint8_t palette    = (obj_palette & 1);
-		const bool priority      = (obj_priority & 1);
+	ppu::line_sprites_t ppu::scan_oam(uint8_t y, uint8_t sprite_size) const
+	{
+		static_assert(sizeof(oam) == 160);
 
-		bg_colour0   >>= 1;
-		bg_colour1   >>= 1;
-		obj_colour0  >>= 1;
-		obj_colour1  >>= 1;
-		obj_palette  >>= 1;
-		obj_priority >>= 1;
+		// a bit per oam entry on the line (0 <= y + 16 - sprite y < sprite size), 4 entries at a time from their y bytes
+		const __m128i line = _mm_set1_epi32(y + 16);
+		const __m128i size = _mm_set1_epi32(sprite_size);
+		const __m128i y_mask = _mm_set1_epi32(0xFF);
+		uint64_t on_line = 0;
+		for (uint8_t i = 0; i < 40; i += 4)
+		{
+			const __m128i entries = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&oam[i]));
+			const __m128i offset = _mm_sub_epi32(line, _mm_and_si128(entries, y_mask));
+			const __m128i in_range = _mm_andnot_si128(_mm_cmplt_epi32(offset, _mm_setzero_si128()), _mm_cmplt_epi32(offset, size));
+			on_line |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(in_range)) << i;
+		}
 
-		if (obj_colour != 0 && (priority || bg_colour == 0))
+		// the first 10 in oam order, inserted by x. ties keep oam order
+		line_sprites_t result;
+		for (; on_line != 0 && result.count < result.sprites.size(); on_line &= on_line - 1)
 		{
-			return ((palette + 1) << 2) | palettes.obj_palettes[palette][obj_colour];
+			sprite_attributes sprite = oam[std::countr_zero(on_line)];
+			if (sprite_size == 16)
+			{
+				sprite.tile_index &= 0xFE;
+			}
+
+			uint8_t index = result.count++;
+			for (; index > 0 && result.sprites[index - 1].x > sprite.x; --index)
+			{
+				result.sprites[index] = result.sprites[index - 1];
+			}
+			result.sprites[index] = sprite;
 		}
-		return palettes.background_palette[bg_colour];
+		return result;
 	}
 
-	void ppu::fifo_t::discard(uint8_t count)
+	void ppu::draw_background_line(uint8_t y)
 	{
-		assert(bg_count >= count);
-		bg_count -= count;
+		uint8_t* line = &screen[y * 160];
+		if (!registers.lcd_control.bg_enable)
+		{
+			std::fill_n(line, 160, registers.palettes.background_palette[0]);
+			return;
+		}
+
+		const uint16_t tiledata_base_addr_low = registers.lcd_control.tiledata_select ? 0x0000 : 0x1000;
+		const uint16_t tiledata_base_addr_high = 0x0000;
+		const uint16_t bg_tilemap_row_addr = (registers.lcd_control.bg_tilemap_select ? 0x1C00 : 0x1800) + (uint8_t)(y + registers.lcd_scroll_y) / 8 * 32;
+		const uint8_t sub_tile_y = (uint8_t)(y + registers.lcd_scroll_y) % 8;
 
-		bg_colour0   >>= count;
-		bg_colour1   >>= count;
-		obj_colour0  >>= count;
-		obj_colour1  >>= count;
-		obj_palette  >>= count;
-		obj_priority >>= count;
+		// the 21 tiles the line touches, then the palette applied from the first visible pixel
+		std::array<uint64_t, 21> rows;
+		for (uint8_t i = 0; i < rows.size(); ++i)
+		{
+			uint8_t tile_index = vram[bg_tilemap_row_addr + (uint8_t)(registers.lcd_scroll_x / 8 + i) % 32];
+			uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+			uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+			rows[i] = decoded_tiles.rows[tile_data_index / 2];
+		}
+		pixels::apply_palette(reinterpret_cast<const uint8_t*>(rows.data()) + registers.lcd_scroll_x % 8, 160, registers.palettes.background_palette.u8, line);
 	}
 
 	single_future<void> ppu::run()
@@ -119,6 +189,9 @@ namespace coro_gb
 				[[unlikely]]
 				if (!registers.lcd_control.lcd_enable)
 				{
+					// turned off, the ppu can't raise an interrupt until it's turned on again, when it starts a frame straight away
+					next_stat_update = scheduler.get_cycle_counter() + INT32_MAX;
+					scheduler.set_interrupt_horizon(next_stat_update);
 					stat_flag = false;
 					vblank_flag = false;
 					registers.lcd_y = 0;
@@ -135,40 +208,26 @@ namespace coro_gb
 				for (uint8_t y = 0; y < 144; ++y)
 				{
 					uint32_t line_start = scheduler.get_cycle_counter();
-					std::vector<sprite_attributes> sprites;
+					line_sprites_t sprites;
 					uint8_t sprite_size = 0;
 
 					[[unlikely]]
 					if (y==0 && bLCDOnBug)
 					{
 						line_start -= 6;
-						update_stat(lcd_mode::initial_power_on, y);
+						update_stat(lcd_mode::initial_power_on, y, 74);
 
 						co_await interruptible_cycles(cycle_scheduler::priority::write, 74);
 					}
 					else
 					{
 						// sort sprites
-						update_stat(lcd_mode::oam_search, y);
+						update_stat(lcd_mode::oam_search, y, 80);
 
 						sprite_size = registers.lcd_control.sprite_size ? 16 : 8;
 						if (registers.lcd_control.sprite_enable)
 						{
-							for (sprite_attributes sprite : oam)
-							{
-								if (sprite.y - 16 <= y && sprite.y - 16 + sprite_size > y)
-								{
-									if (registers.lcd_control.sprite_size)
-										sprite.tile_index &= 0xFE;
-									sprites.push_back(sprite);
-								}
-							}
-
-							if (sprites.size() > 10)
-							{
-								sprites.resize(10);
-							}
-							std::stable_sort(std::begin(sprites), std::end(sprites), [](const sprite_attributes& lhs, const sprite_attributes& rhs) { return lhs.x < rhs.x; });
+							sprites = scan_oam(y, sprite_size);
 						}
 
 						co_await interruptible_cycles(cycle_scheduler::priority::write, 80);
@@ -176,7 +235,13 @@ namespace coro_gb
 					}
 
 					// draw line
-					update_stat(lcd_mode::lcd_write, y);
+					update_stat(lcd_mode::lcd_write, y, bg_fetch_cycles + 8 + 160); // mode 3 at its shortest
+
+					// if nothing else can run before the end of the line (usually because the cpu is halted) then nothing can write to
+					// the registers, vram or oam part way through it, and the whole line can be drawn in one pass with a single wait
+					batch_line = scheduler.is_only_unit_until(cycle_scheduler::unit::ppu, (line_start + 456) - scheduler.get_cycle_counter());
+					batch_start = scheduler.get_cycle_counter();
+					batched_cycles = 0;
 
 					const uint16_t tiledata_base_addr_low = registers.lcd_control.tiledata_select ? 0x0000 : 0x1000;
 					const uint16_t tiledata_base_addr_high = 0x0000;
@@ -191,342 +256,466 @@ namespace coro_gb
 					uint8_t tile_y = (((uint16_t)y + registers.lcd_scroll_y) / 8) % 32;
 					uint16_t sub_tile_y = ((uint16_t)y + registers.lcd_scroll_y) % 8;
 
-					fifo_t fifo; // 8 pixel FIFO
-
-					uint32_t fetch_start = scheduler.get_cycle_counter();
-					co_await interruptible_cycles(cycle_scheduler::priority::read, bg_fetch_cycles);
-					if (bg_enable)
+					if (batch_line && sprites.empty() && !window_enable)
 					{
-						uint8_t tile_index = vram[bg_tilemap_base_addr + tile_y * 32 + tile_x];
-						uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
-						uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
-						uint8_t low_bits = vram[tile_data_index];
-						uint8_t high_bits = vram[tile_data_index + 1];
-						fifo.apply_bg(low_bits, high_bits);
-						fetch_start = scheduler.get_cycle_counter();
+						// nothing interrupts the background fetches, so the line takes a fixed time and can be drawn a tile at a time
+						draw_background_line(y);
+						batched_cycles = bg_fetch_cycles + 8 + 160 + registers.lcd_scroll_x % 8;
 					}
 					else
 					{
-						fifo.apply_bg(0, 0);
-					}
-
-					bool in_window = false;
-					uint8_t window_x = -1;
-					uint8_t current_sprite = 0;
-					uint8_t sprite_x = 0;
-
-					//x = 0 stupidly seems to be processed before SCX
-					{
-						while (current_sprite < sprites.size() && sprites[current_sprite].x == sprite_x)
-						{
-							if ((int32_t)((fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter()) > 0)
-								co_await interruptible_cycles(cycle_scheduler::priority::read, (fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter());
-							co_await interruptible_cycles(cycle_scheduler::priority::read, sprite_fetch_cycles);
-							uint8_t sprite_suby = sprites[current_sprite].flags.flip_y ? sprite_size - 1 - (y - (sprites[current_sprite].y - 16)) : y - (sprites[current_sprite].y - 16);
-							uint16_t tile_data_index = spritedata_base_addr + ((uint16_t)sprites[current_sprite].tile_index * 8 + sprite_suby) * 2;
-							uint8_t low_bits = vram[tile_data_index];
-							uint8_t high_bits = vram[tile_data_index + 1];
-
-							fifo.apply_sprite(low_bits, high_bits, sprites[current_sprite].flags);
-							++current_sprite;
-							//fetch_start = scheduler.get_cycle_counter();
-						}
+						fifo_t fifo; // 8 pixel FIFO
 
-						uint8_t complete = std::min<uint8_t>(fifo.bg_count, 1);
-						if (window_enable && !in_window)
+						uint32_t fetch_start = draw_cycle_counter();
+						co_await draw_cycles(bg_fetch_cycles);
+						if (bg_enable)
 						{
-							complete = std::min<uint8_t>(complete, registers.window_x - window_x);
+							uint8_t tile_index = vram[bg_tilemap_base_addr + tile_y * 32 + tile_x];
+							uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+							uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+							fifo.apply_bg(decoded_tiles.rows[tile_data_index / 2]);
+							fetch_start = draw_cycle_counter();
 						}
-						if (current_sprite < sprites.size())
+						else
 						{
-							complete = std::min<uint8_t>(complete, sprites[current_sprite].x - sprite_x);
+							fifo.apply_bg(0);
 						}
 
-						co_await interruptible_cycles(cycle_scheduler::priority::read, complete);
-						fifo.discard(complete);
-						window_x += complete;
-						sprite_x += complete;
+						bool in_window = false;
+						uint8_t window_x = -1;
+						uint8_t current_sprite = 0;
+						uint8_t sprite_x = 0;
 
-						if (window_enable && !in_window && window_x == registers.window_x)
+						//x = 0 stupidly seems to be processed before SCX
 						{
-							in_window = true;
-							tile_y = (window_line / 8) % 32;
-							sub_tile_y = window_line % 8;
-							++window_line;
+							while (current_sprite < sprites.size() && sprites[current_sprite].x == sprite_x)
+							{
+								if ((int32_t)((fetch_start + bg_fetch_cycles) - draw_cycle_counter()) > 0)
+									co_await draw_cycles((fetch_start + bg_fetch_cycles) - draw_cycle_counter());
+								co_await draw_cycles(sprite_fetch_cycles);
+								uint8_t sprite_suby = sprites[current_sprite].flags.flip_y ? sprite_size - 1 - (y - (sprites[current_sprite].y - 16)) : y - (sprites[current_sprite].y - 16);
+								uint16_t tile_data_index = spritedata_base_addr + ((uint16_t)sprites[current_sprite].tile_index * 8 + sprite_suby) * 2;
+								const auto& rows = sprites[current_sprite].flags.flip_x ? decoded_tiles.flipped_rows : decoded_tiles.rows;
+								fifo.apply_sprite(rows[tile_data_index / 2], sprites[current_sprite].flags);
+								++current_sprite;
+								//fetch_start = draw_cycle_counter();
+							}
 
+							uint8_t complete = std::min<uint8_t>(fifo.bg_count, 1);
+							if (window_enable && !in_window)
 							{
-								co_await interruptible_cycles(cycle_scheduler::priority::read, window_switch_cycles);
-								tile_x = 0;
-								uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
-								uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
-								uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
-								uint8_t low_bits = vram[tile_data_index];
-								uint8_t high_bits = vram[tile_data_index + 1];
-								fifo.apply_bg(low_bits, high_bits);
-								tile_x = 1;
-								fetch_start = scheduler.get_cycle_counter();
+								complete = std::min<uint8_t>(complete, registers.window_x - window_x);
 							}
-						}
-						else if (fifo.bg_count == 0)
-						{
-							if (in_window)
+							if (current_sprite < sprites.size())
 							{
-								if (fetch_start != scheduler.get_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter()) > 0)
-									co_await interruptible_cycles(cycle_scheduler::priority::read, (fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter());
-								uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
-								uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
-								uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
-								uint8_t low_bits = vram[tile_data_index];
-								uint8_t high_bits = vram[tile_data_index + 1];
-								fifo.apply_bg(low_bits, high_bits);
-								tile_x = (tile_x + 1) % 32;
-								fetch_start = scheduler.get_cycle_counter();
+								complete = std::min<uint8_t>(complete, sprites[current_sprite].x - sprite_x);
 							}
-							else if (bg_enable)
+
+							co_await draw_cycles(complete);
+							fifo.discard(complete);
+							window_x += complete;
+							sprite_x += complete;
+
+							if (window_enable && !in_window && window_x == registers.window_x)
 							{
-								if (fetch_start != scheduler.get_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter()) > 0)
-									co_await interruptible_cycles(cycle_scheduler::priority::read, (fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter());
-								uint8_t tile_index = vram[bg_tilemap_base_addr + tile_y * 32 + tile_x];
-								uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
-								uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
-								uint8_t low_bits = vram[tile_data_index];
-								uint8_t high_bits = vram[tile_data_index + 1];
-								fifo.apply_bg(low_bits, high_bits);
-								tile_x = (tile_x + 1) % 32;
-								fetch_start = scheduler.get_cycle_counter();
+								in_window = true;
+								tile_y = (window_line / 8) % 32;
+								sub_tile_y = window_line % 8;
+								++window_line;
+
+								{
+									co_await draw_cycles(window_switch_cycles);
+									tile_x = 0;
+									uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
+									uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+									uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+									fifo.apply_bg(decoded_tiles.rows[tile_data_index / 2]);
+									tile_x = 1;
+									fetch_start = draw_cycle_counter();
+								}
 							}
-							else
+							else if (fifo.bg_count == 0)
 							{
-								fifo.apply_bg(0, 0);
+								if (in_window)
+								{
+									if (fetch_start != draw_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - draw_cycle_counter()) > 0)
+										co_await draw_cycles((fetch_start + bg_fetch_cycles) - draw_cycle_counter());
+									uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
+									uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+									uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+									fifo.apply_bg(decoded_tiles.rows[tile_data_index / 2]);
+									tile_x = (tile_x + 1) % 32;
+									fetch_start = draw_cycle_counter();
+								}
+								else if (bg_enable)
+								{
+									if (fetch_start != draw_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - draw_cycle_counter()) > 0)
+										co_await draw_cycles((fetch_start + bg_fetch_cycles) - draw_cycle_counter());
+									uint8_t tile_index = vram[bg_tilemap_base_addr + tile_y * 32 + tile_x];
+									uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+									uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+									fifo.apply_bg(decoded_tiles.rows[tile_data_index / 2]);
+									tile_x = (tile_x + 1) % 32;
+									fetch_start = draw_cycle_counter();
+								}
+								else
+								{
+									fifo.apply_bg(0);
+								}
 							}
 						}
-					}
 
-					uint8_t subtile_scroll_x = registers.lcd_scroll_x % 8;
-					co_await interruptible_cycles(cycle_scheduler::priority::read, subtile_scroll_x);
-					fifo.discard(subtile_scroll_x);
-
-					// discard first 8 pixels to allow sprites to "scroll on"
-					// and to allow the window to be at 0-6 position
-					for (uint8_t x = 1; x < 8; )
-					{
-						while (current_sprite < sprites.size() && sprites[current_sprite].x == sprite_x)
-						{
-							if ((int32_t)((fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter()) > 0)
-								co_await interruptible_cycles(cycle_scheduler::priority::read, (fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter());
-							co_await interruptible_cycles(cycle_scheduler::priority::read, sprite_fetch_cycles);
-							uint8_t sprite_suby = sprites[current_sprite].flags.flip_y ? sprite_size - 1 - (y - (sprites[current_sprite].y - 16)) : y - (sprites[current_sprite].y - 16);
-							uint16_t tile_data_index = spritedata_base_addr + ((uint16_t)sprites[current_sprite].tile_index * 8 + sprite_suby) * 2;
-							uint8_t low_bits = vram[tile_data_index];
-							uint8_t high_bits = vram[tile_data_index + 1];
-
-							fifo.apply_sprite(low_bits, high_bits, sprites[current_sprite].flags);
-							++current_sprite;
-							//fetch_start = scheduler.get_cycle_counter();
-						}
+						uint8_t subtile_scroll_x = registers.lcd_scroll_x % 8;
+						co_await draw_cycles(subtile_scroll_x);
+						fifo.discard(subtile_scroll_x);
 
-						uint8_t complete = std::min<uint8_t>(fifo.bg_count, 8 - x);
-						if (window_enable && !in_window)
+						// without the window nothing changes the line's timing from here on, so rather than waiting between each part of it
+						// the rest is drawn in one pass while the cpu carries on. if the cpu writes to a palette or vram in the meantime
+						// (mid-line palette changes are a common raster effect) the rest is drawn again, with each write made when it landed
+						// a frame that does that usually does it on every line, so the rest of the frame goes back to waiting between parts
+						const bool log_writes = !batch_line && !window_enable && !mid_line_writes;
+						if (log_writes)
 						{
-							complete = std::min<uint8_t>(complete, registers.window_x - window_x);
+							begin_line_write_log();
 						}
-						if (current_sprite < sprites.size())
+						const auto replay_start = std::make_tuple(fifo, tile_x, fetch_start, current_sprite, sprite_x, window_x);
+						for (bool replay = false; ; replay = true)
 						{
-							complete = std::min<uint8_t>(complete, sprites[current_sprite].x - sprite_x);
-						}
+							if (replay)
+							{
+								std::tie(fifo, tile_x, fetch_start, current_sprite, sprite_x, window_x) = replay_start;
+							}
+
+							// discard first 8 pixels to allow sprites to "scroll on"
+							// and to allow the window to be at 0-6 position
+							for (uint8_t x = 1; x < 8; )
+							{
+								while (current_sprite < sprites.size() && sprites[current_sprite].x == sprite_x)
+								{
+									if ((int32_t)((fetch_start + bg_fetch_cycles) - draw_cycle_counter()) > 0)
+										co_await draw_cycles((fetch_start + bg_fetch_cycles) - draw_cycle_counter());
+									co_await draw_cycles(sprite_fetch_cycles);
+									uint8_t sprite_suby = sprites[current_sprite].flags.flip_y ? sprite_size - 1 - (y - (sprites[current_sprite].y - 16)) : y - (sprites[current_sprite].y - 16);
+									uint16_t tile_data_index = spritedata_base_addr + ((uint16_t)sprites[current_sprite].tile_index * 8 + sprite_suby) * 2;
+									const auto& rows = sprites[current_sprite].flags.flip_x ? decoded_tiles.flipped_rows : decoded_tiles.rows;
+									fifo.apply_sprite(rows[tile_data_index / 2], sprites[current_sprite].flags);
+									++current_sprite;
+									//fetch_start = draw_cycle_counter();
+								}
 
-						co_await interruptible_cycles(cycle_scheduler::priority::read, complete);
-						fifo.discard(complete);
-						x += complete;
-						window_x += complete;
-						sprite_x += complete;
+								uint8_t complete = std::min<uint8_t>(fifo.bg_count, 8 - x);
+								if (window_enable && !in_window)
+								{
+									complete = std::min<uint8_t>(complete, registers.window_x - window_x);
+								}
+								if (current_sprite < sprites.size())
+								{
+									complete = std::min<uint8_t>(complete, sprites[current_sprite].x - sprite_x);
+								}
 
-						if (window_enable && !in_window && window_x == registers.window_x)
-						{
-							in_window = true;
-							tile_y = (window_line / 8) % 32;
-							sub_tile_y = window_line % 8;
-							++window_line;
+								co_await draw_cycles(complete);
+								fifo.discard(complete);
+								x += complete;
+								window_x += complete;
+								sprite_x += complete;
 
-							{
-								co_await interruptible_cycles(cycle_scheduler::priority::read, window_switch_cycles);
-								tile_x = 0;
-								uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
-								uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
-								uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
-								uint8_t low_bits = vram[tile_data_index];
-								uint8_t high_bits = vram[tile_data_index + 1];
-								fifo.apply_bg(low_bits, high_bits);
-								tile_x = 1;
-								fetch_start = scheduler.get_cycle_counter();
+								if (window_enable && !in_window && window_x == registers.window_x)
+								{
+									in_window = true;
+									tile_y = (window_line / 8) % 32;
+									sub_tile_y = window_line % 8;
+									++window_line;
+
+									{
+										co_await draw_cycles(window_switch_cycles);
+										tile_x = 0;
+										uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
+										uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+										uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+										fifo.apply_bg(decoded_tiles.rows[tile_data_index / 2]);
+										tile_x = 1;
+										fetch_start = draw_cycle_counter();
+									}
+								}
+								else if (fifo.bg_count == 0)
+								{
+									if (in_window)
+									{
+										if (fetch_start != draw_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - draw_cycle_counter()) > 0)
+											co_await draw_cycles((fetch_start + bg_fetch_cycles) - draw_cycle_counter());
+										uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
+										uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+										uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+										fifo.apply_bg(decoded_tiles.rows[tile_data_index / 2]);
+										tile_x = (tile_x + 1) % 32;
+										fetch_start = draw_cycle_counter();
+									}
+									else if (bg_enable)
+									{
+										if (fetch_start != draw_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - draw_cycle_counter()) > 0)
+											co_await draw_cycles((fetch_start + bg_fetch_cycles) - draw_cycle_counter());
+										uint8_t tile_index = vram[bg_tilemap_base_addr + tile_y * 32 + tile_x];
+										uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+										uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+										fifo.apply_bg(decoded_tiles.rows[tile_data_index / 2]);
+										tile_x = (tile_x + 1) % 32;
+										fetch_start = draw_cycle_counter();
+									}
+									else
+									{
+										fifo.apply_bg(0);
+									}
+								}
 							}
-						}
-						else if (fifo.bg_count == 0)
-						{
-							if (in_window)
+
+							// draw 160 pixels
+							for (uint8_t x = 0; x < 160; )
 							{
-								if (fetch_start != scheduler.get_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter()) > 0)
-									co_await interruptible_cycles(cycle_scheduler::priority::read, (fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter());
-								uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
-								uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
-								uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
-								uint8_t low_bits = vram[tile_data_index];
-								uint8_t high_bits = vram[tile_data_index + 1];
-								fifo.apply_bg(low_bits, high_bits);
-								tile_x = (tile_x + 1) % 32;
-								fetch_start = scheduler.get_cycle_counter();
+								while (current_sprite < sprites.size() && sprites[current_sprite].x == sprite_x)
+								{
+									if ((int32_t)((fetch_start + bg_fetch_cycles) - draw_cycle_counter()) > 0)
+										co_await draw_cycles((fetch_start + bg_fetch_cycles) - draw_cycle_counter());
+									co_await draw_cycles(sprite_fetch_cycles);
+									uint8_t sprite_suby = sprites[current_sprite].flags.flip_y ? sprite_size - 1 - (y - (sprites[current_sprite].y - 16)) : y - (sprites[current_sprite].y - 16);
+									uint16_t tile_data_index = spritedata_base_addr + ((uint16_t)sprites[current_sprite].tile_index * 8 + sprite_suby) * 2;
+									const auto& rows = sprites[current_sprite].flags.flip_x ? decoded_tiles.flipped_rows : decoded_tiles.rows;
+									fifo.apply_sprite(rows[tile_data_index / 2], sprites[current_sprite].flags);
+									++current_sprite;
+									fetch_start = draw_cycle_counter();
+								}
+
+								uint8_t complete = std::min<uint8_t>(fifo.bg_count, 160 - x);
+								if (window_enable && !in_window)
+								{
+									complete = std::min<uint8_t>(complete, registers.window_x - window_x);
+								}
+								if (current_sprite < sprites.size())
+								{
+									complete = std::min<uint8_t>(complete, sprites[current_sprite].x - sprite_x);
+								}
+
+								co_await draw_cycles(complete);
+								fifo.pop(complete, registers.palettes, &screen[y * 160 + x]);
+								x += complete;
+								window_x += complete;
+								sprite_x += complete;
+
+								if (window_enable && !in_window && window_x == registers.window_x)
+								{
+									in_window = true;
+									tile_y = (window_line / 8) % 32;
+									sub_tile_y = window_line % 8;
+									++window_line;
+
+									{
+										co_await draw_cycles(window_switch_cycles);
+										tile_x = 0;
+										uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
+										uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+										uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+										fifo.apply_bg(decoded_tiles.rows[tile_data_index / 2]);
+										tile_x = 1;
+										fetch_start = draw_cycle_counter();
+									}
+								}
+								else if (fifo.bg_count == 0)
+								{
+									if (in_window)
+									{
+										if (fetch_start != draw_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - draw_cycle_counter()) > 0)
+											co_await draw_cycles((fetch_start + bg_fetch_cycles) - draw_cycle_counter());
+										uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
+										uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+										uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+										fifo.apply_bg(decoded_tiles.rows[tile_data_index / 2]);
+										tile_x = (tile_x + 1) % 32;
+										fetch_start = draw_cycle_counter();
+									}
+									else if (bg_enable)
+									{
+										if (fetch_start != draw_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - draw_cycle_counter()) > 0)
+											co_await draw_cycles((fetch_start + bg_fetch_cycles) - draw_cycle_counter());
+										uint8_t tile_index = vram[bg_tilemap_base_addr + tile_y * 32 + tile_x];
+										uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
+										uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
+										fifo.apply_bg(decoded_tiles.rows[tile_data_index / 2]);
+										tile_x = (tile_x + 1) % 32;
+										fetch_start = draw_cycle_counter();
+									}
+									else
+									{
+										fifo.apply_bg(0);
+									}
+								}
 							}
-							else if (bg_enable)
+
+							if (!log_writes || replay)
 							{
-								if (fetch_start != scheduler.get_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter()) > 0)
-									co_await interruptible_cycles(cycle_scheduler::priority::read, (fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter());
-								uint8_t tile_index = vram[bg_tilemap_base_addr + tile_y * 32 + tile_x];
-								uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
-								uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
-								uint8_t low_bits = vram[tile_data_index];
-								uint8_t high_bits = vram[tile_data_index + 1];
-								fifo.apply_bg(low_bits, high_bits);
-								tile_x = (tile_x + 1) % 32;
-								fetch_start = scheduler.get_cycle_counter();
+								break;
 							}
-							else
+							co_await interruptible_cycles(cycle_scheduler::priority::read, batched_cycles);
+							if (!end_line_write_log())
 							{
-								fifo.apply_bg(0, 0);
+								break;
 							}
 						}
-					}
-
-					// draw 160 pixels
-					for (uint8_t x = 0; x < 160; )
-					{
-						while (current_sprite < sprites.size() && sprites[current_sprite].x == sprite_x)
-						{
-							if ((int32_t)((fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter()) > 0)
-								co_await interruptible_cycles(cycle_scheduler::priority::read, (fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter());
-							co_await interruptible_cycles(cycle_scheduler::priority::read, sprite_fetch_cycles);
-							uint8_t sprite_suby = sprites[current_sprite].flags.flip_y ? sprite_size - 1 - (y - (sprites[current_sprite].y - 16)) : y - (sprites[current_sprite].y - 16);
-							uint16_t tile_data_index = spritedata_base_addr + ((uint16_t)sprites[current_sprite].tile_index * 8 + sprite_suby) * 2;
-							uint8_t low_bits = vram[tile_data_index];
-							uint8_t high_bits = vram[tile_data_index + 1];
-
-							fifo.apply_sprite(low_bits, high_bits, sprites[current_sprite].flags);
-							++current_sprite;
-							fetch_start = scheduler.get_cycle_counter();
-						}
-
-						uint8_t complete = std::min<uint8_t>(fifo.bg_count, 160 - x);
-						if (window_enable && !in_window)
-						{
-							complete = std::min<uint8_t>(complete, registers.window_x - window_x);
-						}
-						if (current_sprite < sprites.size())
-						{
-							complete = std::min<uint8_t>(complete, sprites[current_sprite].x - sprite_x);
-						}
-
-						co_await interruptible_cycles(cycle_scheduler::priority::read, complete);
-						for (int i = 0; i < complete; ++i)
+						if (log_writes)
 						{
-							screen[y * 160 + x + i] = fifo.pop(registers.palettes);
+							batch_line = false; // the line's wait is done already
 						}
-						x += complete;
-						window_x += complete;
-						sprite_x += complete;
 
-						if (window_enable && !in_window && window_x == registers.window_x)
-						{
-							in_window = true;
-							tile_y = (window_line / 8) % 32;
-							sub_tile_y = window_line % 8;
-							++window_line;
+						assert(bLCDOnBug || (int32_t)(draw_cycle_counter() - (line_start + 80+168+5 + subtile_scroll_x)) >= 0);
+					}
 
-							{
-								co_await interruptible_cycles(cycle_scheduler::priority::read, window_switch_cycles);
-								tile_x = 0;
-								uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
-								uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
-								uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
-								uint8_t low_bits = vram[tile_data_index];
-								uint8_t high_bits = vram[tile_data_index + 1];
-								fifo.apply_bg(low_bits, high_bits);
-								tile_x = 1;
-								fetch_start = scheduler.get_cycle_counter();
-							}
-						}
-						else if (fifo.bg_count == 0)
-						{
-							if (in_window)
-							{
-								if (fetch_start != scheduler.get_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter()) > 0)
-									co_await interruptible_cycles(cycle_scheduler::priority::read, (fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter());
-								uint8_t tile_index = vram[window_tilemap_base_addr + tile_y * 32 + tile_x];
-								uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
-								uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
-								uint8_t low_bits = vram[tile_data_index];
-								uint8_t high_bits = vram[tile_data_index + 1];
-								fifo.apply_bg(low_bits, high_bits);
-								tile_x = (tile_x + 1) % 32;
-								fetch_start = scheduler.get_cycle_counter();
-							}
-							else if (bg_enable)
-							{
-								if (fetch_start != scheduler.get_cycle_counter() && (int32_t)((fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter()) > 0)
-									co_await interruptible_cycles(cycle_scheduler::priority::read, (fetch_start + bg_fetch_cycles) - scheduler.get_cycle_counter());
-								uint8_t tile_index = vram[bg_tilemap_base_addr + tile_y * 32 + tile_x];
-								uint16_t tile_data_base_addr = (tile_index < 0x80 ? tiledata_base_addr_low : tiledata_base_addr_high);
-								uint16_t tile_data_index = tile_data_base_addr + ((uint16_t)tile_index * 8 + sub_tile_y) * 2;
-								uint8_t low_bits = vram[tile_data_index];
-								uint8_t high_bits = vram[tile_data_index + 1];
-								fifo.apply_bg(low_bits, high_bits);
-								tile_x = (tile_x + 1) % 32;
-								fetch_start = scheduler.get_cycle_counter();
-							}
-							else
-							{
-								fifo.apply_bg(0, 0);
-							}
-						}
+					if (batch_line)
+					{
+						co_await interruptible_cycles(cycle_scheduler::priority::read, batched_cycles);
 					}
 
-					assert(bLCDOnBug || (int32_t)(scheduler.get_cycle_counter() - (line_start + 80+168+5 + subtile_scroll_x)) >= 0);
 					//co_await interruptible_cycles(cycle_scheduler::priority::write, 174); //? Geikko says this should be 173.5
 
 					// h blank
-					update_stat(lcd_mode::h_blank, y);
+					update_stat(lcd_mode::h_blank, y, (line_start + 456) - scheduler.get_cycle_counter());
 
 					co_await interruptible_cycles(cycle_scheduler::priority::write, (line_start + 456) - scheduler.get_cycle_counter());
 					bLCDOnBug = false;
 				}
 
 				display_callback();
+				mid_line_writes = false;
 
 				//v blank
 				for (uint8_t y = 144; y < 153; ++y)
 				{
-					update_stat(lcd_mode::v_blank, y);
+					update_stat(lcd_mode::v_blank, y, 456);
 
 					co_await interruptible_cycles(cycle_scheduler::priority::write, 456);
 				}
 
 				// line 153 is weird
-				update_stat(lcd_mode::v_blank, 153);
+				update_stat(lcd_mode::v_blank, 153, 8);
 				co_await interruptible_cycles(cycle_scheduler::priority::write, 4);
 
 				registers.lcd_y = 0;
 				co_await interruptible_cycles(cycle_scheduler::priority::write, 4);
 
 				registers.lcd_stat.coincidence = 0;
-				update_stat(lcd_mode::v_blank, 0);
+				update_stat(lcd_mode::v_blank, 0, 456 - 8);
 				co_await interruptible_cycles(cycle_scheduler::priority::write, 456 - 8);
 			}
 			catch (interrupted i)
 			{
 				// the ppu was turned off so we need to go back to the beginning
+				batch_line = false;
+				log_line_writes = false;
+				memory.set_video_writes_logged(false);
+				line_writes.clear();
 				continue;
 			}
 		}
 	}
 
+	ppu::line_cycles ppu::draw_cycles(uint32_t wait)
+	{
+		return { interruptible_cycles(cycle_scheduler::priority::read, wait), wait, batch_line ? this : nullptr };
+	}
+
+	uint32_t ppu::draw_cycle_counter() const
+	{
+		return batch_line ? batch_start + batched_cycles : scheduler.get_cycle_counter();
+	}
+
+	void ppu::add_batched_cycles(uint32_t cycles)
+	{
+		batched_cycles += cycles;
+
+		// when a line is drawn again, the writes that had landed by now
+		while (replayed_line_writes < line_writes.size() && (int32_t)(line_writes[replayed_line_writes].cycle - draw_cycle_counter()) <= 0)
+		{
+			const line_write& write = line_writes[replayed_line_writes++];
+			set_line_write_value(write.address, write.value);
+		}
+	}
+
+	void ppu::begin_line_write_log()
+	{
+		batch_line = true;
+		log_line_writes = true;
+		memory.set_video_writes_logged(true);
+		batch_start = scheduler.get_cycle_counter();
+		batched_cycles = 0;
+		line_writes.clear();
+		replayed_line_writes = 0;
+
+		// update_stat() restores the plain mapping at h blank
+		memory.set_mapping({ 0x8000, 0x9FFF, vram.data(), [this](uint16_t address, uint8_t value) { log_line_write(address, value); } });
+	}
+
+	bool ppu::end_line_write_log()
+	{
+		log_line_writes = false;
+		memory.set_video_writes_logged(false);
+		if (line_writes.empty())
+		{
+			return false;
+		}
+		mid_line_writes = true;
+
+		// back to how things were when the line started drawing, the writes are made again as it's redrawn
+		for (auto it = line_writes.rbegin(); it != line_writes.rend(); ++it)
+		{
+			set_line_write_value(it->address, it->old_value);
+		}
+		batched_cycles = 0;
+		return true;
+	}
+
+	void ppu::log_line_write(uint16_t address, uint8_t value)
+	{
+		line_writes.push_back({ scheduler.get_cycle_counter(), address, get_line_write_value(address), value });
+		set_line_write_value(address, value);
+	}
+
+	uint8_t ppu::get_line_write_value(uint16_t address) const
+	{
+		if (address < 0xA000)
+		{
+			return vram[address - 0x8000];
+		}
+		return on_register_read(address);
+	}
+
+	void ppu::set_line_write_value(uint16_t address, uint8_t value)
+	{
+		if (address < 0xA000)
+		{
+			write_vram(address, value);
+		}
+		else if (address == 0xFF47)
+		{
+			registers.palettes.background_palette.u8 = value;
+		}
+		else
+		{
+			registers.palettes.obj_palettes[address - 0xFF48].u8 = value;
+		}
+	}
+
+	void ppu::map_vram()
+	{
+		memory.set_mapping({ 0x8000, 0x9FFF, vram.data(), [this](uint16_t address, uint8_t value) { write_vram(address, value); } });
+	}
+
+	void ppu::write_vram(uint16_t address, uint8_t value)
+	{
+		const uint16_t index = address - 0x8000;
+		vram[index] = value;
+		if (index < 0x1800)
+		{
+			decoded_tiles.decode_row(index / 2, vram[index & ~1], vram[index | 1]);
+		}
+	}
+
 	uint8_t ppu::on_register_read(uint16_t address) const
 	{
 		if (address == 0xFF40)
@@ -579,6 +768,13 @@ namespace coro_gb
 
 	void ppu::on_register_write(uint16_t address, uint8_t u8)
 	{
+		// the palettes are the only registers read part way through drawing a line without the window
+		if (log_line_writes && address >= 0xFF47 && address <= 0xFF49)
+		{
+			log_line_write(address, u8);
+			return;
+		}
+
 		if (address == 0xFF40)
 		{
 			bool old_lcdc_lcd_enable = registers.lcd_control.lcd_enable;
@@ -693,12 +889,13 @@ namespace coro_gb
 			memory_mapper::interrupt_bits_t pending_interrupts = (memory.interrupt_flag & memory.interrupt_enable);
 			if ((pending_interrupts.u8 & 0x1F) != 0)
 			{
+				scheduler.set_interrupt_pending(true);
 				memory.interrupts.cpu_wake.trigger();
 			}
 		}
 	}
 
-	void ppu::update_stat(lcd_mode mode, uint8_t y)
+	void ppu::update_stat(lcd_mode mode, uint8_t y, uint32_t next_update)
 	{
 		if (registers.lcd_y != y)
 		{
@@ -711,7 +908,7 @@ namespace coro_gb
 		case lcd_mode::initial_power_on:
 		case lcd_mode::h_blank:
 			memory.set_mapping({ 0xFE00, 0xFEA0, (uint8_t*) oam.data(), (uint8_t*) oam.data() }); // restore access to oam
-			memory.set_mapping({ 0x8000, 0x9FFF, vram.data(), vram.data() });                     // restore access to vram
+			map_vram();                                                                           // restore access to vram
 			break;
 		case lcd_mode::v_blank:
 			break;
@@ -731,7 +928,11 @@ namespace coro_gb
 					registers.lcd_stat.coincidence = (registers.lcd_yc == registers.lcd_y);
 					update_interrupt_flags(mode);
 				}
+				scheduler.set_interrupt_horizon(next_stat_update);
 			});
+
+		next_stat_update = scheduler.get_cycle_counter() + next_update;
+		scheduler.set_interrupt_horizon(scheduler.get_cycle_counter() + 4);
 	}
 
 	single_future<void> ppu::run_dma()
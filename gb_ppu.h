@@ -7,6 +7,7 @@
 #include <array>
 #include <cstdint>
 #include <functional>
+#include <vector>
 
 namespace coro_gb
 {
@@ -27,6 +28,55 @@ namespace coro_gb
 		cycle_scheduler::awaitable_cycles cycles(cycle_scheduler::priority priority, uint32_t wait);
 		cycle_scheduler::awaitable_cycles_interruptible interruptible_cycles(cycle_scheduler::priority priority, uint32_t wait);
 
+		// a wait while drawing a line, or when the line is being drawn in one pass, cycles added on to a single wait at the end of it
+		struct line_cycles final
+		{
+			cycle_scheduler::awaitable_cycles_interruptible wait;
+			uint32_t cycles;
+			ppu* batching;
+
+			bool await_ready() noexcept
+			{
+				if (batching)
+				{
+					batching->add_batched_cycles(cycles);
+					return true;
+				}
+				return wait.await_ready();
+			}
+			void await_suspend(std::coroutine_handle<> handle) noexcept
+			{
+				wait.await_suspend(handle);
+			}
+			void await_resume()
+			{
+				if (!batching)
+				{
+					wait.await_resume();
+				}
+			}
+		};
+
+		line_cycles draw_cycles(uint32_t wait);
+		uint32_t draw_cycle_counter() const;
+		void add_batched_cycles(uint32_t cycles);
+
+		// a palette or vram write made while a line was being drawn in one pass, with the cycle it landed on
+		struct line_write final
+		{
+			uint32_t cycle;
+			uint16_t address;
+			uint8_t old_value;
+			uint8_t value;
+		};
+
+		void begin_line_write_log();
+		// true if anything was written, in which case the writes are undone to be made again as the line is redrawn
+		bool end_line_write_log();
+		void log_line_write(uint16_t address, uint8_t value);
+		uint8_t get_line_write_value(uint16_t address) const;
+		void set_line_write_value(uint16_t address, uint8_t value);
+
 		struct sprite_attributes
 		{
 			uint8_t y;
@@ -69,20 +119,40 @@ namespace coro_gb
 			palette_t obj_palettes[2];
 		};
 		
+		// the sprites on a line, at most 10 (the first found in oam) sorted by x
+		struct line_sprites_t
+		{
+			std::array<sprite_attributes, 10> sprites;
+			uint8_t count = 0;
+
+			bool empty() const { return count == 0; }
+			uint8_t size() const { return count; }
+			const sprite_attributes& operator[](uint8_t index) const { return sprites[index]; }
+		};
+
+		// the tile data (0x8000-0x97FF) with each row of 8 pixels decoded to a colour (0-3) per byte, the leftmost pixel in the low byte
+		// and flipped, the rightmost pixel in the low byte, for sprites with flip_x. kept up to date by write_vram()
+		struct decoded_tiles_t
+		{
+			void decode_row(uint16_t row, uint8_t low_bits, uint8_t high_bits);
+
+			std::array<uint64_t, 384 * 8> rows;
+			std::array<uint64_t, 384 * 8> flipped_rows;
+		};
+
 		struct fifo_t
 		{
-			uint8_t bg_count   = 0;
-			uint8_t bg_colour0 = 0;
-			uint8_t bg_colour1 = 0;
-
-			uint8_t obj_colour0  = 0;
-			uint8_t obj_colour1  = 0;
-			uint8_t obj_palette  = 0;
-			uint8_t obj_priority = 0; // 0 = no or low priority pixel, 1 = high prio pixel
-
-			void apply_bg(uint8_t low_bits, uint8_t high_bits);
-			void apply_sprite(uint8_t low_bits, uint8_t high_bits, sprite_attributes::flags_t flags);
-			uint8_t pop(const palettes_t& palettes);
+			// a pixel per byte, the next to be popped in the low byte
+			static constexpr uint8_t obj_palette_bit = 0x04;
+			static constexpr uint8_t obj_priority_bit = 0x08; // 0 = no or low priority pixel, 1 = high prio pixel
+
+			uint8_t bg_count = 0;
+			uint64_t bg_pixels = 0; // colour
+			uint64_t obj_pixels = 0; // colour, palette and priority
+
+			void apply_bg(uint64_t row);
+			void apply_sprite(uint64_t row, sprite_attributes::flags_t flags);
+			void pop(uint8_t count, const palettes_t& palettes, uint8_t* out);
 			void discard(uint8_t count);
 		};
 
@@ -119,10 +189,23 @@ namespace coro_gb
 		bool stat_flag = false;
 		bool vblank_flag = false;
 		void update_interrupt_flags(lcd_mode mode);
-		void update_stat(lcd_mode mode, uint8_t y);
+		// next_update is the soonest the next update_stat() can be, in cycles from this one
+		void update_stat(lcd_mode mode, uint8_t y, uint32_t next_update);
+
+		// the ppu only raises interrupts in update_stat() and the stat change it queues 4 cycles later, so the scheduler's
+		// interrupt horizon is that change until it has been made, and then the next update_stat()
+		uint32_t next_stat_update = 0;
+
+		// the background for a whole line, as the fifo would draw it with no sprites or window and no registers changing part way
+		line_sprites_t scan_oam(uint8_t y, uint8_t sprite_size) const;
+		void draw_background_line(uint8_t y);
 
 		single_future<void> run_dma();
 
+		// cpu access to vram goes through write_vram() to keep decoded_tiles up to date
+		void map_vram();
+		void write_vram(uint16_t address, uint8_t value);
+
 		cycle_scheduler& scheduler;
 		memory_mapper& memory;
 
@@ -132,6 +215,15 @@ namespace coro_gb
 
 		single_future<void> dma_task;
 
+		// drawing a line in one pass, see run()
+		bool batch_line = false;
+		bool log_line_writes = false;
+		uint32_t batch_start = 0;
+		uint32_t batched_cycles = 0;
+		std::vector<line_write> line_writes;
+		size_t replayed_line_writes = 0;
+		bool mid_line_writes = false; // this frame
+
 		// LCD Interrupts:
 		struct interrupts_t
 		{
@@ -142,6 +234,7 @@ namespace coro_gb
 
 		// LCD VRAM
 		std::array<std::uint8_t, 8192> vram;
+		decoded_tiles_t decoded_tiles;
 		std::array<sprite_attributes, 40> oam;
 
 		// LCD Registers:
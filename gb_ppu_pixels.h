@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// the simd versions need ssse3 (for pshufb), which the project's /arch:AVX includes
+// set to 0 to use the scalar versions instead, tools/pixel_benchmark.cpp checks the two give identical results
+#ifndef COROGB_SIMD_PIXELS
+#if defined(__AVX__) || defined(__SSSE3__)
+#define COROGB_SIMD_PIXELS 1
+#else
+#define COROGB_SIMD_PIXELS 0
+#endif
+#endif
+
+#if COROGB_SIMD_PIXELS
+#include <immintrin.h>
+#endif
+
+// turning decoded pixels into the screen buffer's format
+// pixels are a colour (0-3) per byte as in ppu::decoded_tiles_t, sprite pixels also have their palette in bit 2 and priority in bit 3
+// (1 = above the background) as in ppu::fifo_t. the screen gets the shade from the palette, plus 4 for obj palette 0 or 8 for 1
+namespace coro_gb::pixels
+{
+	constexpr uint8_t obj_palette_bit = 0x04;
+	constexpr uint8_t obj_priority_bit = 0x08;
+
+	// the four shades of a palette register, one per byte
+	constexpr std::array<uint32_t, 256> make_palette_shades()
+	{
+		std::array<uint32_t, 256> table{};
+		for (uint32_t palette = 0; palette < 256; ++palette)
+		{
+			for (uint32_t colour = 0; colour < 4; ++colour)
+			{
+				table[palette] |= ((palette >> (colour * 2)) & 0x03) << (colour * 8);
+			}
+		}
+		return table;
+	}
+
+	inline constexpr std::array<uint32_t, 256> palette_shades = make_palette_shades();
+
+	namespace scalar
+	{
+		inline void apply_palette(const uint8_t* colours, uint8_t count, uint8_t palette, uint8_t* out)
+		{
+			for (uint8_t i = 0; i < count; ++i)
+			{
+				out[i] = (palette >> (colours[i] * 2)) & 0x03;
+			}
+		}
+
+		// count is at most 8, the first pixel is in the low byte
+		inline void compose(uint64_t bg_pixels, uint64_t obj_pixels, uint8_t count, uint8_t bg_palette, uint8_t obj_palette0, uint8_t obj_palette1, uint8_t* out)
+		{
+			for (uint8_t i = 0; i < count; ++i, bg_pixels >>= 8, obj_pixels >>= 8)
+			{
+				const uint8_t bg_colour = bg_pixels & 0x03;
+				const uint8_t obj_colour = obj_pixels & 0x03;
+				const uint8_t palette = (obj_pixels & obj_palette_bit) != 0;
+				const bool priority = (obj_pixels & obj_priority_bit) != 0;
+
+				if (obj_colour != 0 && (priority || bg_colour == 0))
+				{
+					out[i] = ((palette + 1) << 2) | (((palette ? obj_palette1 : obj_palette0) >> (obj_colour * 2)) & 0x03);
+				}
+				else
+				{
+					out[i] = (bg_palette >> (bg_colour * 2)) & 0x03;
+				}
+			}
+		}
+	}
+
+#if COROGB_SIMD_PIXELS
+	namespace simd
+	{
+		// 16 pixels at a time, the rest by scalar::apply_palette()
+		inline void apply_palette(const uint8_t* colours, uint8_t count, uint8_t palette, uint8_t* out)
+		{
+			const __m128i shades = _mm_cvtsi32_si128((int)palette_shades[palette]);
+			uint8_t i = 0;
+			for (; i + 16 <= count; i += 16)
+			{
+				const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colours + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(shades, pixels));
+			}
+			scalar::apply_palette(colours + i, count - i, palette, out + i);
+		}
+
+		// all 8 pixels are worked out, but only count are written
+		inline void compose(uint64_t bg_pixels, uint64_t obj_pixels, uint8_t count, uint8_t bg_palette, uint8_t obj_palette0, uint8_t obj_palette1, uint8_t* out)
+		{
+			const __m128i bg = _mm_cvtsi64_si128((long long)bg_pixels);
+			const __m128i obj = _mm_cvtsi64_si128((long long)obj_pixels);
+
+			// obj shades are looked up by palette and colour together, with the palette's screen bit already in place
+			const __m128i bg_shades = _mm_cvtsi32_si128((int)palette_shades[bg_palette]);
+			const __m128i obj_shades = _mm_set_epi32(0, 0, (int)(palette_shades[obj_palette1] | 0x08080808), (int)(palette_shades[obj_palette0] | 0x04040404));
+			const __m128i bg_out = _mm_shuffle_epi8(bg_shades, bg);
+			const __m128i obj_out = _mm_shuffle_epi8(obj_shades, _mm_and_si128(obj, _mm_set1_epi8(0x07)));
+
+			// the sprite pixel shows if it isn't transparent, and is either above the background or the background is colour 0
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i obj_transparent = _mm_cmpeq_epi8(_mm_and_si128(obj, _mm_set1_epi8(0x03)), zero);
+			const __m128i obj_above = _mm_cmpeq_epi8(_mm_and_si128(obj, _mm_set1_epi8(obj_priority_bit)), _mm_set1_epi8(obj_priority_bit));
+			const __m128i bg_transparent = _mm_cmpeq_epi8(bg, zero);
+			const __m128i obj_shown = _mm_andnot_si128(obj_transparent, _mm_or_si128(obj_above, bg_transparent));
+
+			const __m128i result = _mm_or_si128(_mm_and_si128(obj_shown, obj_out), _mm_andnot_si128(obj_shown, bg_out));
+			if (count == 8)
+			{
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out), result);
+			}
+			else
+			{
+				alignas(16) uint8_t pixels[16];
+				_mm_store_si128(reinterpret_cast<__m128i*>(pixels), result);
+				for (uint8_t i = 0; i < count; ++i)
+				{
+					out[i] = pixels[i];
+				}
+			}
+		}
+	}
+
+	using simd::apply_palette;
+	using simd::compose;
+#else
+	using scalar::apply_palette;
+	using scalar::compose;
+#endif
+}
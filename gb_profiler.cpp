@@ -0,0 +1,306 @@
+#include "gb_profiler.h"
+#include "gb_cart.h"
+#include "gb_cpu.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+namespace coro_gb
+{
+	profiler::profiler(cycle_scheduler& scheduler, const cpu_base& cpu)
+		: scheduler{ scheduler }
+		, sampled_cpu{ cpu }
+	{
+	}
+
+	void profiler::start(const cart& cart, uint32_t in_sample_period)
+	{
+		stop();
+
+		sampled_cart = &cart;
+		sample_period = std::max<uint32_t>(in_sample_period, 1);
+		running = true;
+		queue_sample();
+	}
+
+	void profiler::stop()
+	{
+		// the already queued sample can't be removed from the scheduler, so just make it do nothing
+		++generation;
+		running = false;
+	}
+
+	void profiler::clear()
+	{
+		samples.clear();
+		call_tree.assign(1, {});
+		call_stack.clear();
+		frames = 0;
+	}
+
+	void profiler::queue_sample()
+	{
+		scheduler.queue(scheduler.get_cycle_counter() + sample_period, cycle_scheduler::unit::debug, cycle_scheduler::priority::read,
+			[this, queued_generation = generation]() {
+				if (queued_generation != generation)
+				{
+					return;
+				}
+
+				const uint16_t pc = sampled_cpu.get_pc();
+				const uint16_t bank = pc <= 0x7FFF ? sampled_cart->get_rom_bank(pc) : 0;
+				++samples[make_location(bank, pc)];
+				queue_sample();
+			});
+	}
+
+	void profiler::on_call(uint16_t destination, uint16_t sp)
+	{
+		if (!running)
+		{
+			return;
+		}
+
+		// frames whose return address is at or above the new one have already been left, by a tail jump or stack manipulation
+		const auto live = std::find_if(call_stack.rbegin(), call_stack.rend(), [sp](const call_frame& frame) { return frame.return_sp > sp; });
+		pop_call_frames(live - call_stack.rbegin());
+
+		const uint32_t parent = call_stack.empty() ? 0 : call_stack.back().node;
+		const uint16_t bank = destination <= 0x7FFF ? sampled_cart->get_rom_bank(destination) : 0;
+		const uint32_t location = make_location(bank, destination);
+
+		uint32_t node;
+		auto it = call_tree[parent].children.find(location);
+		if (it != call_tree[parent].children.end())
+		{
+			node = it->second;
+		}
+		else
+		{
+			node = (uint32_t)call_tree.size();
+			call_tree[parent].children.emplace(location, node);
+			call_node& new_node = call_tree.emplace_back();
+			new_node.location = location;
+		}
+
+		++call_tree[node].calls;
+		call_stack.push_back({ node, sp, scheduler.get_cycle_counter(), 0 });
+	}
+
+	void profiler::on_return(uint16_t sp)
+	{
+		// find the frame this return address belongs to
+		// anything above it was left by a tail jump or stack manipulation, so ends here as well
+		// if there isn't one the code is returning to an address it pushed itself, which isn't a call
+		auto it = std::find_if(call_stack.rbegin(), call_stack.rend(), [sp](const call_frame& frame) { return frame.return_sp == sp; });
+		if (it == call_stack.rend())
+		{
+			return;
+		}
+
+		pop_call_frames((it - call_stack.rbegin()) + 1);
+	}
+
+	void profiler::end_frame()
+	{
+		if (!running)
+		{
+			return;
+		}
+
+		// the functions still running are counted up to now, and from now on as if they'd just been called
+		const uint32_t now = scheduler.get_cycle_counter();
+		for (auto it = call_stack.rbegin(); it != call_stack.rend(); ++it)
+		{
+			const uint32_t inclusive_cycles = now - it->entry_cycle;
+			add_call_cycles(it->node, inclusive_cycles, inclusive_cycles - it->child_cycles);
+			if (it + 1 != call_stack.rend())
+			{
+				(it + 1)->child_cycles += inclusive_cycles;
+			}
+			it->entry_cycle = now;
+			it->child_cycles = 0;
+		}
+
+		for (call_node& node : call_tree)
+		{
+			node.peak_frame_inclusive_cycles = std::max(node.peak_frame_inclusive_cycles, node.frame_inclusive_cycles);
+			node.frame_inclusive_cycles = 0;
+		}
+		++frames;
+	}
+
+	void profiler::pop_call_frames(size_t count)
+	{
+		const uint32_t now = scheduler.get_cycle_counter();
+		for (size_t i = 0; i < count; ++i)
+		{
+			const call_frame frame = call_stack.back();
+			call_stack.pop_back();
+
+			const uint32_t inclusive_cycles = now - frame.entry_cycle;
+			add_call_cycles(frame.node, inclusive_cycles, inclusive_cycles - frame.child_cycles);
+			if (!call_stack.empty())
+			{
+				call_stack.back().child_cycles += inclusive_cycles;
+			}
+		}
+	}
+
+	void profiler::add_call_cycles(uint32_t node, uint64_t inclusive_cycles, uint64_t exclusive_cycles)
+	{
+		call_tree[node].inclusive_cycles += inclusive_cycles;
+		call_tree[node].exclusive_cycles += exclusive_cycles;
+		call_tree[node].frame_inclusive_cycles += inclusive_cycles;
+	}
+
+	bool profiler::load_symbols(const std::filesystem::path& sym_path)
+	{
+		std::ifstream f{ sym_path };
+		if (!f)
+		{
+			return false;
+		}
+
+		// RGBDS: "bb:aaaa label" lines, with ; comments
+		// WLA-DX: the same, but grouped in [sections] of which only [labels] are addresses
+		bool in_labels = true;
+		std::string line;
+		while (std::getline(f, line))
+		{
+			line.erase(std::find(line.begin(), line.end(), ';'), line.end());
+			if (line.empty())
+			{
+				continue;
+			}
+			if (line[0] == '[')
+			{
+				in_labels = (line.rfind("[labels]", 0) == 0);
+				continue;
+			}
+			if (!in_labels)
+			{
+				continue;
+			}
+
+			std::istringstream line_stream{ line };
+			std::string location;
+			std::string name;
+			if (!(line_stream >> location >> name))
+			{
+				continue;
+			}
+			const size_t colon = location.find(':');
+			if (colon == std::string::npos)
+			{
+				continue;
+			}
+			try
+			{
+				const uint16_t bank = (uint16_t)std::stoul(location.substr(0, colon), nullptr, 16);
+				const uint16_t address = (uint16_t)std::stoul(location.substr(colon + 1), nullptr, 16);
+				// keep the first label when there are aliases at the same address
+				symbols.emplace(make_location(address <= 0x7FFF ? bank : 0, address), std::move(name));
+			}
+			catch (std::logic_error&)
+			{
+				// not a label line
+			}
+		}
+		return true;
+	}
+
+	std::string profiler::symbolise(uint32_t location) const
+	{
+		const uint16_t bank = location >> 16;
+		const uint16_t address = location & 0xFFFF;
+
+		// nearest label at or before the address, in the same bank
+		auto it = symbols.upper_bound(location);
+		if (it != symbols.begin())
+		{
+			--it;
+			if ((it->first >> 16) == bank)
+			{
+				return it->second;
+			}
+		}
+
+		std::ostringstream name;
+		name << std::hex << std::setfill('0') << std::setw(2) << bank << ':' << std::setw(4) << address;
+		return name.str();
+	}
+
+	void profiler::write_flat_profile(std::ostream& out) const
+	{
+		std::unordered_map<std::string, uint32_t> by_symbol;
+		uint64_t total = 0;
+		for (const auto& [location, count] : samples)
+		{
+			by_symbol[symbolise(location)] += count;
+			total += count;
+		}
+
+		std::vector<std::pair<std::string, uint32_t>> sorted{ by_symbol.begin(), by_symbol.end() };
+		std::sort(sorted.begin(), sorted.end(), [](const auto& lhs, const auto& rhs) { return lhs.second > rhs.second; });
+
+		out << "samples  percent  symbol\n";
+		for (const auto& [symbol, count] : sorted)
+		{
+			out << std::setw(7) << count << "  "
+				<< std::fixed << std::setprecision(2) << std::setw(6) << (100.0 * count / total) << "%  "
+				<< symbol << '\n';
+		}
+	}
+
+	void profiler::write_call_tree(std::ostream& out) const
+	{
+		out << frames << " frames\n";
+		out << "  inclusive   exclusive       calls   per frame  peak frame  function\n";
+		write_call_tree(out, 0, 0);
+	}
+
+	void profiler::write_call_tree(std::ostream& out, uint32_t node_index, uint32_t depth) const
+	{
+		const call_node& node = call_tree[node_index];
+		if (node_index != 0)
+		{
+			out << std::setw(11) << node.inclusive_cycles << ' '
+				<< std::setw(11) << node.exclusive_cycles << ' '
+				<< std::setw(11) << node.calls << ' '
+				<< std::setw(11) << (frames != 0 ? node.inclusive_cycles / frames : 0) << ' '
+				<< std::setw(11) << node.peak_frame_inclusive_cycles << "  "
+				<< std::string(depth * 2, ' ') << symbolise(node.location) << '\n';
+			++depth;
+		}
+
+		// most expensive first
+		std::vector<uint32_t> children;
+		for (const auto& [location, child] : node.children)
+		{
+			children.push_back(child);
+		}
+		std::sort(children.begin(), children.end(), [this](uint32_t lhs, uint32_t rhs) { return call_tree[lhs].inclusive_cycles > call_tree[rhs].inclusive_cycles; });
+		for (uint32_t child : children)
+		{
+			write_call_tree(out, child, depth);
+		}
+	}
+
+	void profiler::write_collapsed_stacks(std::ostream& out) const
+	{
+		// samples only record the PC, not the shadow call stack, so each is a single frame (the call stack is in write_call_tree())
+		std::map<std::string, uint64_t> stacks;
+		for (const auto& [location, count] : samples)
+		{
+			stacks[symbolise(location)] += count;
+		}
+		for (const auto& [stack, count] : stacks)
+		{
+			out << stack << ' ' << count << '\n';
+		}
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "gb_cycle_scheduler.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace coro_gb
+{
+	struct cpu_base;
+	struct cart;
+
+	// sampling profiler for the emulated program (not the emulator!)
+	// every N cycles an event on the debug unit records the cpu's current rom bank and PC
+	// the cost is one queued event per sample, so it's cheap enough to leave running for a whole play session
+	// when built with COROGB_CALL_PROFILER the cpu also reports every call and return, for exact cycle counts per function
+	struct profiler final
+	{
+		profiler(cycle_scheduler& scheduler, const cpu_base& cpu);
+
+		void start(const cart& cart, uint32_t sample_period);
+		void stop();
+		bool is_running() const
+		{
+			return running;
+		}
+		void clear();
+
+		// loads labels from an RGBDS or WLA-DX .sym file, returns false if it doesn't exist
+		bool load_symbols(const std::filesystem::path& sym_path);
+
+		// one line per symbol: sample count, percentage, bank:symbol
+		void write_flat_profile(std::ostream& out) const;
+		// "folded" format as used by flamegraph.pl / speedscope / inferno
+		void write_collapsed_stacks(std::ostream& out) const;
+		// indented call tree: inclusive cycles, exclusive cycles, call count, mean and peak inclusive cycles per frame, bank:symbol
+		void write_call_tree(std::ostream& out) const;
+
+		// called by the cpu, with SP pointing at the return address
+		void on_call(uint16_t destination, uint16_t sp);
+		void on_return(uint16_t sp);
+		// called when the ppu finishes a frame, functions still running are counted up to here in this frame and the rest in the next
+		void end_frame();
+
+	protected:
+		void queue_sample();
+		std::string symbolise(uint32_t location) const;
+		void write_call_tree(std::ostream& out, uint32_t node_index, uint32_t depth) const;
+		// ends the top frames of the shadow call stack, and the cycles they took
+		void pop_call_frames(size_t count);
+		void add_call_cycles(uint32_t node, uint64_t inclusive_cycles, uint64_t exclusive_cycles);
+
+		// locations are bank << 16 | address, for both samples and symbols
+		static constexpr uint32_t make_location(uint16_t bank, uint16_t address)
+		{
+			return (uint32_t)bank << 16 | address;
+		}
+
+		cycle_scheduler& scheduler;
+		const cpu_base& sampled_cpu;
+		const cart* sampled_cart = nullptr;
+		uint32_t sample_period = 0;
+		uint32_t generation = 0; // invalidates samples queued before a stop()
+		bool running = false;
+
+		std::unordered_map<uint32_t, uint32_t> samples;
+		std::map<uint32_t, std::string> symbols;
+
+		// one node per distinct call path, node 0 is the root (code not inside any call)
+		struct call_node
+		{
+			uint32_t location = 0;
+			uint64_t calls = 0;
+			uint64_t inclusive_cycles = 0;
+			uint64_t exclusive_cycles = 0;
+			uint64_t frame_inclusive_cycles = 0; // so far this frame
+			uint64_t peak_frame_inclusive_cycles = 0;
+			std::unordered_map<uint32_t, uint32_t> children; // location -> node index
+		};
+		std::vector<call_node> call_tree{ 1 };
+		uint32_t frames = 0;
+
+		// shadow of the guest call stack
+		struct call_frame
+		{
+			uint32_t node;
+			uint16_t return_sp;
+			uint32_t entry_cycle;
+			uint64_t child_cycles;
+		};
+		std::vector<call_frame> call_stack;
+	};
+}
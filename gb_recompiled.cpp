@@ -0,0 +1,66 @@
+#include "gb_recompiled.h"
+#include "gb_cart.h"
+
+namespace coro_gb
+{
+	namespace
+	{
+		// a function static, as registrations run during static initialisation in whatever order the generated files are linked
+		std::vector<const recompiled_rom*>& registered_roms()
+		{
+			static std::vector<const recompiled_rom*> roms;
+			return roms;
+		}
+	}
+
+	recompiled_rom_registration::recompiled_rom_registration(const recompiled_rom& rom)
+	{
+		registered_roms().push_back(&rom);
+	}
+
+	uint64_t hash_rom(const std::vector<uint8_t>& rom)
+	{
+		// fnv-1a, tools/recompiler.cpp has a copy
+		uint64_t hash = 0xCBF29CE484222325;
+		for (const uint8_t byte : rom)
+		{
+			hash = (hash ^ byte) * 0x100000001B3;
+		}
+		return hash;
+	}
+
+	const recompiled_rom* find_recompiled_rom(uint64_t rom_hash)
+	{
+		for (const recompiled_rom* rom : registered_roms())
+		{
+			if (rom->rom_hash == rom_hash)
+			{
+				return rom;
+			}
+		}
+		return nullptr;
+	}
+
+	recompiled_code::recompiled_code(const recompiled_rom& rom, const cart& in_cart)
+		: code_cart{ in_cart }
+	{
+		functions.reserve(rom.block_count);
+		for (size_t i = 0; i < rom.block_count; ++i)
+		{
+			const recompiled_block& block = rom.blocks[i];
+			addresses.set(block.address);
+			functions.emplace(make_location(block.bank, block.address), block.function);
+		}
+	}
+
+	recompiled_function recompiled_code::find(uint16_t address) const
+	{
+		if (address > 0x7FFF || !addresses.test(address))
+		{
+			return nullptr;
+		}
+
+		const auto found = functions.find(make_location(code_cart.get_rom_bank(address), address));
+		return found != functions.end() ? found->second : nullptr;
+	}
+}
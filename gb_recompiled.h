@@ -0,0 +1,353 @@
+#pragma once
+
+#include "gb_alu_tables.h"
+#include "gb_cpu.h"
+#include "gb_cycle_scheduler.h"
+#include "gb_memory_mapper.h"
+
+#include <bitset>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace coro_gb
+{
+	struct cart;
+	struct recompiled_context;
+
+	// rom code recompiled ahead of time to c++ by tools/recompiler.cpp
+	// the generated .cpp is added to the build, and registers itself to be used whenever the same rom is loaded
+	// the cpu runs a recompiled block whenever it arrives at its (bank, address), and falls back to interpreting anything else
+
+	// runs from the block's address, returns false if it had to stop early and leave the rest to the interpreter
+	using recompiled_function = bool (*)(recompiled_context& context);
+
+	struct recompiled_block final
+	{
+		uint16_t bank;
+		uint16_t address;
+		recompiled_function function;
+	};
+
+	struct recompiled_rom final
+	{
+		const char* title;
+		uint64_t rom_hash; // hash_rom() of the whole rom, as test roms often share the same header checksum
+		const recompiled_block* blocks;
+		size_t block_count;
+	};
+
+	// generated code declares one of these at namespace scope
+	struct recompiled_rom_registration final
+	{
+		recompiled_rom_registration(const recompiled_rom& rom);
+	};
+
+	uint64_t hash_rom(const std::vector<uint8_t>& rom);
+	const recompiled_rom* find_recompiled_rom(uint64_t rom_hash);
+
+	// the blocks of a recompiled rom, looked up by the rom bank currently mapped at the address
+	struct recompiled_code final
+	{
+		recompiled_code(const recompiled_rom& rom, const cart& in_cart);
+
+		recompiled_function find(uint16_t address) const;
+
+	protected:
+		static uint32_t make_location(uint16_t bank, uint16_t address)
+		{
+			return (uint32_t)bank << 16 | address;
+		}
+
+		const cart& code_cart;
+		std::bitset<0x8000> addresses; // quick rejection before looking up the bank
+		std::unordered_map<uint32_t, recompiled_function> functions;
+	};
+
+	// the interface recompiled code runs against, the cpu's own registers and the memory_mapper
+	// every access waits exactly as the interpreter would, but an instruction is only started if no other unit would run before it ends,
+	// which is what lets it run straight through without ever suspending
+	struct recompiled_context final
+	{
+		recompiled_context(cpu_base& cpu, uint32_t additional_cycles)
+			: registers{ cpu.registers }
+			, additional_cycles{ additional_cycles }
+			, cpu{ cpu }
+		{
+		}
+
+		registers_t& registers;
+		uint32_t additional_cycles; // dummy cycles to add to the next wait, as in cpu::run()
+
+		// the top of cpu::run()'s loop and the opcode fetch
+		// false if an interrupt is due or another unit needs to run within the instruction's cycles, then the interpreter continues from address
+		bool begin(uint16_t address, uint32_t cycles)
+		{
+			if ((registers.enable_interrupts && ((cpu.memory.interrupt_flag & cpu.memory.interrupt_enable).u8 & 0x1F) != 0) ||
+				!cpu.scheduler.is_exclusive_until(cycle_scheduler::unit::cpu, cycle_scheduler::priority::read, additional_cycles + cycles))
+			{
+				registers.PC = address;
+				return false;
+			}
+
+			if (!registers.enable_interrupts)
+			{
+				registers.enable_interrupts = registers.enable_interrupts_delay;
+			}
+			wait(4);
+			return true;
+		}
+
+		// for push/call/rst, which write twice: a first write to an io register could start another unit before the second
+		bool begin_push(uint16_t address, uint32_t cycles)
+		{
+			if (is_io((uint16_t)(registers.SP - 1)) || is_io((uint16_t)(registers.SP - 2)))
+			{
+				registers.PC = address;
+				return false;
+			}
+			return begin(address, cycles);
+		}
+
+		// an operand read, the value is constant and was read at compile time
+		void idle_read()
+		{
+			wait(4);
+		}
+
+		uint8_t read(uint16_t address)
+		{
+			wait(4);
+			return cpu.memory.read8(address);
+		}
+
+		void write(uint16_t address, uint8_t value)
+		{
+			wait(4);
+			cpu.memory.write8(address, value);
+			rom_written |= address <= 0x7FFF;
+		}
+
+		void dummy(uint32_t cycles)
+		{
+			additional_cycles += cycles;
+		}
+
+		// true if an mbc register was written since the last call, the rom banks may have changed under the block
+		bool take_rom_written()
+		{
+			const bool result = rom_written;
+			rom_written = false;
+			return result;
+		}
+
+		void push(uint16_t value)
+		{
+			registers.SP--;
+			dummy(4);
+			write(registers.SP--, value >> 8);
+			write(registers.SP, value & 0xFF);
+		}
+
+		uint16_t pop()
+		{
+			uint16_t value = read(registers.SP++);
+			value |= static_cast<uint16_t>(read(registers.SP++)) << 8;
+			return value;
+		}
+
+		uint16_t get_af() const
+		{
+			return registers.AF;
+		}
+
+		void set_af(uint16_t value)
+		{
+			registers.AF = value;
+			registers.F.padding = 0;
+		}
+
+		bool flag_zero() const
+		{
+			return registers.F.zero;
+		}
+
+		bool flag_carry() const
+		{
+			return registers.F.carry;
+		}
+
+		void add(uint8_t value)
+		{
+			arithmetic(value, false, false);
+		}
+
+		void adc(uint8_t value)
+		{
+			arithmetic(value, false, registers.F.carry);
+		}
+
+		void sub(uint8_t value)
+		{
+			arithmetic(value, true, false);
+		}
+
+		void sbc(uint8_t value)
+		{
+			arithmetic(value, true, registers.F.carry);
+		}
+
+		void logic_and(uint8_t value)
+		{
+			registers.A &= value;
+			logic(true);
+		}
+
+		void logic_xor(uint8_t value)
+		{
+			registers.A ^= value;
+			logic(false);
+		}
+
+		void logic_or(uint8_t value)
+		{
+			registers.A |= value;
+			logic(false);
+		}
+
+		void cp(uint8_t value)
+		{
+			registers.F = run_alu(registers.A, value, true, false).flags;
+		}
+
+		uint8_t inc(uint8_t value)
+		{
+			++value;
+			registers.F.half_carry = ((value & 0xF) == 0);
+			registers.F.subtract = 0;
+			registers.F.zero = (value == 0);
+			return value;
+		}
+
+		uint8_t dec(uint8_t value)
+		{
+			--value;
+			registers.F.half_carry = ((value & 0xF) == 0xF);
+			registers.F.subtract = 1;
+			registers.F.zero = (value == 0);
+			return value;
+		}
+
+		void add_hl(uint16_t value)
+		{
+			const uint16_t original = registers.HL;
+			const uint32_t result32 = (uint32_t)original + value;
+			registers.HL = (uint16_t)result32;
+			registers.F.carry = result32 > 0xFFFF;
+			registers.F.half_carry = ((original & 0x0FFF) + (value & 0x0FFF)) > 0x0FFF;
+			registers.F.subtract = 0;
+		}
+
+		// add sp,e and ld hl,sp+e
+		uint16_t add_sp(int8_t value)
+		{
+			const uint16_t original = registers.SP;
+			registers.F.carry = ((original & 0xFF) + (value & 0xFF)) > 0xFF;
+			registers.F.half_carry = ((original & 0x0F) + (value & 0x0F)) > 0x0F;
+			registers.F.subtract = 0;
+			registers.F.zero = 0;
+			return (uint16_t)(original + value);
+		}
+
+		// rlca/rrca/rla/rra
+		void rotate_a(uint8_t operation)
+		{
+			const uint16_t result = alu::run_shift(operation, registers.A, registers.F.carry);
+			registers.A = (uint8_t)result;
+			registers.F.carry = result >> 8;
+			registers.F.half_carry = 0;
+			registers.F.subtract = 0;
+			registers.F.zero = 0;
+		}
+
+		void daa()
+		{
+			const uint16_t result = alu::run_daa(registers.A, registers.F.subtract, registers.F.half_carry, registers.F.carry);
+			registers.A = (uint8_t)result;
+			registers.F.carry = result >> 8;
+			registers.F.half_carry = 0;
+			registers.F.zero = (registers.A == 0);
+		}
+
+		void cpl()
+		{
+			registers.A = ~registers.A;
+			registers.F.half_carry = 1;
+			registers.F.subtract = 1;
+		}
+
+		void scf()
+		{
+			registers.F.carry = 1;
+			registers.F.half_carry = 0;
+			registers.F.subtract = 0;
+		}
+
+		void ccf()
+		{
+			registers.F.carry = !registers.F.carry;
+			registers.F.half_carry = 0;
+			registers.F.subtract = 0;
+		}
+
+		// cb rotates/shifts
+		uint8_t shift(uint8_t operation, uint8_t value)
+		{
+			const uint16_t result = alu::run_shift(operation, value, registers.F.carry);
+			registers.F.carry = result >> 8;
+			registers.F.half_carry = 0;
+			registers.F.subtract = 0;
+			registers.F.zero = ((uint8_t)result == 0);
+			return (uint8_t)result;
+		}
+
+		void bit(uint8_t mask, uint8_t value)
+		{
+			registers.F.zero = !(value & mask);
+			registers.F.half_carry = 1;
+			registers.F.subtract = 0;
+		}
+
+	protected:
+		void arithmetic(uint8_t value, bool subtract, bool carry)
+		{
+			alu_result result = run_alu(registers.A, value, subtract, carry);
+			registers.A = result.value;
+			registers.F = result.flags;
+		}
+
+		// and/xor/or
+		void logic(bool half_carry)
+		{
+			registers.F.carry = 0;
+			registers.F.half_carry = half_carry;
+			registers.F.subtract = 0;
+			registers.F.zero = (registers.A == 0);
+		}
+
+		void wait(uint32_t cycles)
+		{
+			// can't fail, begin() already checked nothing else runs before the instruction ends
+			cpu.scheduler.try_wait(cycle_scheduler::unit::cpu, cycle_scheduler::priority::read, additional_cycles + cycles);
+			additional_cycles = 0;
+		}
+
+		static bool is_io(uint16_t address)
+		{
+			return address >= 0xFF00 && address <= 0xFF7F;
+		}
+
+		cpu_base& cpu;
+		bool rom_written = false;
+	};
+}
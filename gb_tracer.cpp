@@ -0,0 +1,149 @@
+#include "gb_tracer.h"
+#include "gb_cpu.h"
+#include "gb_memory_mapper.h"
+
+#include <stdexcept>
+
+namespace coro_gb
+{
+	namespace
+	{
+		// "A:00 F:11 B:22 C:33 D:44 E:55 H:66 L:77 SP:8888 PC:9999 PCMEM:AA,BB,CC,DD\n"
+		constexpr size_t line_length = 74;
+
+		// one block being filled, one being written, and one spare so the emulator rarely has to wait
+		constexpr size_t block_count = 3;
+
+		char* write_hex(char* out, uint8_t value)
+		{
+			constexpr char digits[] = "0123456789ABCDEF";
+			*out++ = digits[value >> 4];
+			*out++ = digits[value & 0xF];
+			return out;
+		}
+
+		char* write_field(char* out, const char* name, uint8_t value)
+		{
+			while (*name)
+			{
+				*out++ = *name++;
+			}
+			return write_hex(out, value);
+		}
+	}
+
+	tracer::tracer(const std::filesystem::path& trace_path)
+		: file{ trace_path, std::ios::binary }
+	{
+		if (!file)
+		{
+			throw std::runtime_error("couldn't open trace file");
+		}
+		if (trace_path.extension() == ".lz4")
+		{
+			compressor.emplace(file);
+		}
+
+		current.data.resize(lz4::max_block_size);
+		for (size_t i = 1; i < block_count; ++i)
+		{
+			free_blocks.push_back({ std::vector<uint8_t>(lz4::max_block_size), 0 });
+		}
+		writer = std::thread{ &tracer::write_blocks, this };
+	}
+
+	tracer::~tracer()
+	{
+		submit_block();
+		{
+			std::lock_guard lock{ mutex };
+			exiting = true;
+		}
+		blocks_changed.notify_all();
+		writer.join();
+
+		if (compressor)
+		{
+			compressor->finish();
+		}
+	}
+
+	void tracer::trace(const registers_t& registers, memory_mapper& memory)
+	{
+		if (current.size + line_length > current.data.size())
+		{
+			submit_block();
+		}
+
+		char* out = reinterpret_cast<char*>(current.data.data() + current.size);
+		out = write_field(out, "A:", registers.A);
+		out = write_field(out, " F:", *reinterpret_cast<const uint8_t*>(&registers.F));
+		out = write_field(out, " B:", registers.B);
+		out = write_field(out, " C:", registers.C);
+		out = write_field(out, " D:", registers.D);
+		out = write_field(out, " E:", registers.E);
+		out = write_field(out, " H:", registers.H);
+		out = write_field(out, " L:", registers.L);
+		out = write_field(out, " SP:", registers.SP >> 8);
+		out = write_hex(out, registers.SP & 0xFF);
+		out = write_field(out, " PC:", registers.PC >> 8);
+		out = write_hex(out, registers.PC & 0xFF);
+		out = write_field(out, " PCMEM:", memory.read8(registers.PC));
+		out = write_field(out, ",", memory.read8((uint16_t)(registers.PC + 1)));
+		out = write_field(out, ",", memory.read8((uint16_t)(registers.PC + 2)));
+		out = write_field(out, ",", memory.read8((uint16_t)(registers.PC + 3)));
+		*out++ = '\n';
+		current.size += line_length;
+	}
+
+	void tracer::submit_block()
+	{
+		if (current.size == 0)
+		{
+			return;
+		}
+
+		std::unique_lock lock{ mutex };
+		full_blocks.push_back(std::move(current));
+		blocks_changed.notify_all();
+
+		// if the writer can't keep up this is where the emulator waits for it
+		blocks_changed.wait(lock, [this] { return !free_blocks.empty(); });
+		current = std::move(free_blocks.back());
+		free_blocks.pop_back();
+		current.size = 0;
+	}
+
+	void tracer::write_blocks()
+	{
+		while (true)
+		{
+			block next;
+			{
+				std::unique_lock lock{ mutex };
+				blocks_changed.wait(lock, [this] { return !full_blocks.empty() || exiting; });
+				if (full_blocks.empty())
+				{
+					return;
+				}
+				next = std::move(full_blocks.front());
+				full_blocks.pop_front();
+			}
+
+			if (compressor)
+			{
+				compressor->write(next.data.data(), next.size);
+			}
+			else
+			{
+				file.write(reinterpret_cast<const char*>(next.data.data()), next.size);
+			}
+
+			{
+				std::lock_guard lock{ mutex };
+				free_blocks.push_back(std::move(next));
+			}
+			blocks_changed.notify_all();
+		}
+	}
+}
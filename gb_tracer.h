@@ -0,0 +1,56 @@
+#pragma once
+
+#include "gb_lz4.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace coro_gb
+{
+	struct registers_t;
+	struct memory_mapper;
+
+	// per-instruction trace in gameboy-doctor format, for diffing against other emulators (see tools/trace_diff.cpp)
+	// A:00 F:11 B:22 C:33 D:44 E:55 H:66 L:77 SP:8888 PC:9999 PCMEM:AA,BB,CC,DD
+	// lines are formatted straight into preallocated blocks, full blocks are compressed and written out on a background thread
+	// traces are lz4 compressed if the path ends in .lz4, otherwise they're plain text
+	struct tracer final
+	{
+		tracer(const std::filesystem::path& trace_path);
+		~tracer();
+
+		tracer(const tracer&) = delete;
+		tracer& operator=(const tracer&) = delete;
+
+		// called by the cpu before each instruction, registers.F must be up to date
+		void trace(const registers_t& registers, memory_mapper& memory);
+
+	protected:
+		struct block final
+		{
+			std::vector<uint8_t> data;
+			size_t size = 0;
+		};
+
+		void submit_block();
+		void write_blocks();
+
+		std::ofstream file;
+		std::optional<lz4::frame_writer> compressor;
+
+		block current;
+		std::mutex mutex;
+		std::condition_variable blocks_changed;
+		std::deque<block> full_blocks;
+		std::vector<block> free_blocks;
+		bool exiting = false;
+		std::thread writer;
+	};
+}
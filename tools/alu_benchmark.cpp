@@ -0,0 +1,92 @@
+// times the daa and shift tables in gb_alu_tables.h against the arithmetic versions they're built from, on random inputs
+// the results are compared as well, as COROGB_ALU_TABLES must not change what the cpu computes
+//
+// usage: alu_benchmark [iterations]
+// build: cl /std:c++20 /O2 /EHsc /I.. alu_benchmark.cpp
+//    or: g++ -std=c++20 -O2 -D__forceinline=inline -I.. alu_benchmark.cpp -o alu_benchmark
+
+#include "gb_alu_tables.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+	constexpr size_t input_count = 1 << 16;
+
+	struct inputs final
+	{
+		// an op (for shift) or the subtract flag (for daa) in bits 0-2, then the half carry and carry flags in bits 3 and 4
+		std::vector<uint8_t> values;
+		std::vector<uint8_t> flags;
+	};
+
+	inputs make_inputs()
+	{
+		std::mt19937 random{ 0x6B };
+		inputs result;
+		result.values.resize(input_count);
+		result.flags.resize(input_count);
+		for (size_t i = 0; i < input_count; ++i)
+		{
+			result.values[i] = (uint8_t)random();
+			result.flags[i] = (uint8_t)(random() & 0x1F);
+		}
+		return result;
+	}
+
+	template <typename kernel_t>
+	double time(uint32_t iterations, const inputs& in, std::vector<uint16_t>& results, kernel_t kernel)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < iterations; ++i)
+		{
+			for (size_t input = 0; input < input_count; ++input)
+			{
+				// each result feeds into the next input, as a run of instructions on A would, so the loads can't all be overlapped
+				const uint8_t value = in.values[input] ^ (uint8_t)results[(input - 1) % input_count];
+				results[input] = kernel(value, in.flags[input]);
+			}
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count();
+	}
+
+	template <typename table_t, typename arithmetic_t>
+	bool benchmark(const char* name, uint32_t iterations, const inputs& in, table_t table, arithmetic_t arithmetic)
+	{
+		std::vector<uint16_t> table_results(input_count);
+		std::vector<uint16_t> arithmetic_results(input_count);
+		const double table_seconds = time(iterations, in, table_results, table);
+		const double arithmetic_seconds = time(iterations, in, arithmetic_results, arithmetic);
+		const bool match = table_results == arithmetic_results;
+
+		const double operations = (double)iterations * input_count;
+		std::cout << name
+			<< ": arithmetic " << arithmetic_seconds * 1e9 / operations << "ns/op"
+			<< ", table " << table_seconds * 1e9 / operations << "ns/op"
+			<< " (" << arithmetic_seconds / table_seconds << "x)"
+			<< (match ? "" : ", RESULTS DIFFER") << '\n';
+		return match;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t iterations = argc > 1 ? std::stoul(argv[1]) : 1000;
+	const inputs in = make_inputs();
+	bool all_match = true;
+
+	std::cout << std::fixed << std::setprecision(3);
+	all_match &= benchmark("daa", iterations, in,
+		[](uint8_t value, uint8_t flags) { return coro_gb::alu::daa_table[value | (flags & 1) << 8 | (flags >> 3 & 1) << 9 | (flags >> 4 & 1) << 10]; },
+		[](uint8_t value, uint8_t flags) { return coro_gb::alu::daa(value, flags & 1, flags >> 3 & 1, flags >> 4 & 1); });
+	all_match &= benchmark("shift", iterations, in,
+		[](uint8_t value, uint8_t flags) { return coro_gb::alu::shift_table[value | (flags >> 4 & 1) << 8 | (flags & 0b111) << 9]; },
+		[](uint8_t value, uint8_t flags) { return coro_gb::alu::shift(flags & 0b111, value, flags >> 4 & 1); });
+	return all_match ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+// runs the same roms on both cpu backends (the coroutine cpu and cpu_state_machine) and compares their speed
+// the screens are compared as well, as both backends must have identical timing
+//
+// usage: cpu_benchmark <boot rom> <frames> <rom>...
+// build: cl /std:c++20 /O2 /EHsc /I.. cpu_benchmark.cpp ../gb_*.cpp
+//    or: g++ -std=c++20 -O2 -I.. cpu_benchmark.cpp ../gb_*.cpp -o cpu_benchmark -lpthread
+
+#include "gb_emu.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	constexpr uint32_t cycles_per_frame = 70224;
+
+	struct result final
+	{
+		double seconds = 0;
+		std::vector<uint8_t> screen;
+	};
+
+	template <typename cpu_t>
+	result run(const std::filesystem::path& boot_rom_path, const std::filesystem::path& rom_path, uint32_t frames)
+	{
+		// battery saves go to a scratch file rather than next to the rom
+		coro_gb::cart cart{ rom_path, std::filesystem::temp_directory_path() / "cpu_benchmark.sav" };
+		coro_gb::emu_t<cpu_t> emu;
+		emu.set_display_callback([] {});
+		emu.load_boot_rom(boot_rom_path);
+		emu.load_cart(cart);
+		emu.start();
+
+		const auto start = std::chrono::steady_clock::now();
+		for (uint32_t frame = 0; frame < frames; ++frame)
+		{
+			// a rom that STOPs would otherwise stop the clock
+			if (emu.tick(cycles_per_frame) == coro_gb::tick_result::stopped)
+			{
+				break;
+			}
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		const uint8_t* screen = emu.get_screen_buffer();
+		return { elapsed.count(), { screen, screen + 160 * 144 } };
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 4)
+	{
+		std::cerr << "usage: cpu_benchmark <boot rom> <frames> <rom>...\n";
+		return 2;
+	}
+
+	try
+	{
+		const std::filesystem::path boot_rom_path = argv[1];
+		const uint32_t frames = std::stoul(argv[2]);
+		bool all_match = true;
+
+		std::cout << std::fixed << std::setprecision(3);
+		for (int i = 3; i < argc; ++i)
+		{
+			const result coroutine = run<coro_gb::cpu>(boot_rom_path, argv[i], frames);
+			const result state_machine = run<coro_gb::cpu_state_machine>(boot_rom_path, argv[i], frames);
+			const bool match = coroutine.screen == state_machine.screen;
+			all_match &= match;
+
+			std::cout << std::filesystem::path(argv[i]).filename().string()
+				<< ": coroutine " << coroutine.seconds << "s"
+				<< ", state machine " << state_machine.seconds << "s"
+				<< " (" << state_machine.seconds / coroutine.seconds << "x)"
+				<< (match ? "" : ", SCREENS DIFFER") << '\n';
+		}
+		return all_match ? 0 : 1;
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << ex.what() << '\n';
+		return 2;
+	}
+}
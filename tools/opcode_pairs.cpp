@@ -0,0 +1,166 @@
+// counts how often each pair of opcodes runs back to back, to choose which pairs deserve a fused handler (see cpu_base::run_fused_pair())
+// reads gameboy-doctor style traces (F10), plain text or lz4 compressed, and prints the most common pairs over all of them
+// cb-prefixed opcodes count as one opcode, e.g. "CB 7C"
+//
+// usage: opcode_pairs <trace>...
+// build: cl /std:c++20 /O2 /EHsc /I.. opcode_pairs.cpp ../gb_lz4.cpp
+//    or: g++ -std=c++20 -O2 -I.. opcode_pairs.cpp ../gb_lz4.cpp -o opcode_pairs
+
+#include "gb_lz4.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	constexpr size_t pairs_shown = 40;
+
+	struct trace_reader final
+	{
+		trace_reader(const char* path)
+			: file{ path, std::ios::binary }
+		{
+			if (!file)
+			{
+				throw std::runtime_error(std::string("couldn't open ") + path);
+			}
+			if (coro_gb::lz4::is_frame(file))
+			{
+				decompressor.emplace(file);
+			}
+		}
+
+		bool getline(std::string& line)
+		{
+			line.clear();
+			while (true)
+			{
+				if (position == buffer.size())
+				{
+					if (!refill())
+					{
+						return !line.empty();
+					}
+				}
+
+				const uint8_t* start = buffer.data() + position;
+				const uint8_t* end = buffer.data() + buffer.size();
+				const uint8_t* newline = std::find(start, end, '\n');
+				line.append(start, newline);
+				position = newline - buffer.data();
+				if (newline != end)
+				{
+					++position;
+					if (!line.empty() && line.back() == '\r')
+					{
+						line.pop_back();
+					}
+					return true;
+				}
+			}
+		}
+
+	protected:
+		bool refill()
+		{
+			position = 0;
+			if (decompressor)
+			{
+				return decompressor->read(buffer);
+			}
+			buffer.resize(1024 * 1024);
+			file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+			buffer.resize(file.gcount());
+			return !buffer.empty();
+		}
+
+		std::ifstream file;
+		std::optional<coro_gb::lz4::frame_reader> decompressor;
+		std::vector<uint8_t> buffer;
+		size_t position = 0;
+	};
+
+	// the opcode from a line's "PCMEM:AA,BB,CC,DD", with 0x100 added for cb-prefixed opcodes
+	std::optional<uint16_t> parse_opcode(const std::string& line)
+	{
+		const size_t pcmem = line.find("PCMEM:");
+		if (pcmem == std::string::npos || line.size() < pcmem + 11)
+		{
+			return std::nullopt;
+		}
+		const uint16_t opcode = (uint16_t)std::stoul(line.substr(pcmem + 6, 2), nullptr, 16);
+		if (opcode == 0xCB)
+		{
+			return (uint16_t)(0x100 | std::stoul(line.substr(pcmem + 9, 2), nullptr, 16));
+		}
+		return opcode;
+	}
+
+	std::string opcode_name(uint16_t opcode)
+	{
+		char buffer[8];
+		std::snprintf(buffer, sizeof(buffer), opcode & 0x100 ? "CB %02X" : "%02X", opcode & 0xFF);
+		return buffer;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "usage: opcode_pairs <trace>...\n";
+		return 2;
+	}
+
+	try
+	{
+		std::unordered_map<uint32_t, uint64_t> pair_counts;
+		uint64_t instructions = 0;
+		for (int i = 1; i < argc; ++i)
+		{
+			trace_reader trace{ argv[i] };
+			std::optional<uint16_t> previous;
+			std::string line;
+			while (trace.getline(line))
+			{
+				const std::optional<uint16_t> opcode = parse_opcode(line);
+				if (!opcode)
+				{
+					continue;
+				}
+				++instructions;
+				if (previous)
+				{
+					++pair_counts[(uint32_t)*previous << 16 | *opcode];
+				}
+				previous = opcode;
+			}
+		}
+
+		std::vector<std::pair<uint32_t, uint64_t>> sorted{ pair_counts.begin(), pair_counts.end() };
+		std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+		std::cout << instructions << " instructions, " << sorted.size() << " different pairs\n";
+		std::cout << std::fixed << std::setprecision(2);
+		for (size_t i = 0; i < std::min(sorted.size(), pairs_shown); ++i)
+		{
+			const auto& [pair, count] = sorted[i];
+			std::cout << std::setw(12) << count << std::setw(8) << 100.0 * count / instructions << "%  "
+				<< opcode_name(pair >> 16) << " + " << opcode_name(pair & 0xFFFF) << '\n';
+		}
+		return 0;
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << ex.what() << '\n';
+		return 2;
+	}
+}
@@ -0,0 +1,134 @@
+// times the simd pixel kernels in gb_ppu_pixels.h against their scalar versions, on random pixels and palettes
+// the outputs are compared as well, as the two must give identical screens
+//
+// usage: pixel_benchmark [iterations]
+// build: cl /std:c++20 /O2 /EHsc /arch:AVX /I.. pixel_benchmark.cpp
+//    or: g++ -std=c++20 -O2 -mavx -I.. pixel_benchmark.cpp -o pixel_benchmark
+
+#include "gb_ppu_pixels.h"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+	constexpr size_t line_count = 1024;
+
+	struct inputs final
+	{
+		// a line's worth of background colours (with the 8 extra a scrolled line can need), and fifo contents for the compose kernel
+		std::vector<uint8_t> colours;
+		std::vector<uint64_t> bg_pixels;
+		std::vector<uint64_t> obj_pixels;
+		std::vector<uint8_t> counts;
+		std::vector<uint8_t> palettes;
+	};
+
+	inputs make_inputs()
+	{
+		std::mt19937_64 random{ 0x6B };
+		inputs result;
+		result.colours.resize(line_count * 168);
+		for (uint8_t& colour : result.colours)
+		{
+			colour = random() & 0x03;
+		}
+		for (size_t i = 0; i < line_count * 20; ++i)
+		{
+			result.bg_pixels.push_back(random() & 0x0303030303030303);
+			// mostly transparent sprite pixels, like a real line
+			result.obj_pixels.push_back(random() & random() & 0x0F0F0F0F0F0F0F0F);
+			result.counts.push_back(random() % 3 ? 8 : 1 + random() % 8);
+		}
+		for (size_t i = 0; i < line_count * 3; ++i)
+		{
+			result.palettes.push_back((uint8_t)random());
+		}
+		return result;
+	}
+
+	template <typename kernel_t>
+	double time(uint32_t iterations, std::vector<uint8_t>& screen, kernel_t kernel)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < iterations; ++i)
+		{
+			kernel(screen);
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count();
+	}
+
+	template <typename scalar_t, typename simd_t>
+	bool benchmark(const char* name, uint32_t iterations, scalar_t scalar, simd_t simd)
+	{
+		std::vector<uint8_t> scalar_screen(line_count * 160);
+		std::vector<uint8_t> simd_screen(line_count * 160);
+		const double scalar_seconds = time(iterations, scalar_screen, scalar);
+		const double simd_seconds = time(iterations, simd_screen, simd);
+		const bool match = scalar_screen == simd_screen;
+
+		const double pixels = (double)iterations * line_count * 160;
+		std::cout << name
+			<< ": scalar " << scalar_seconds * 1e9 / pixels << "ns/pixel"
+			<< ", simd " << simd_seconds * 1e9 / pixels << "ns/pixel"
+			<< " (" << scalar_seconds / simd_seconds << "x)"
+			<< (match ? "" : ", PIXELS DIFFER") << '\n';
+		return match;
+	}
+
+	template <typename compose_t>
+	void compose_lines(const inputs& in, std::vector<uint8_t>& screen, compose_t compose)
+	{
+		for (size_t line = 0; line < line_count; ++line)
+		{
+			const uint8_t* palettes = &in.palettes[line * 3];
+			uint8_t* out = &screen[line * 160];
+			// chunks as the fifo would hand them out, the last one cut short at the end of the line
+			for (size_t chunk = line * 20, x = 0; x < 160; ++chunk)
+			{
+				const uint8_t count = (uint8_t)std::min<size_t>(in.counts[chunk], 160 - x);
+				compose(in.bg_pixels[chunk], in.obj_pixels[chunk], count, palettes[0], palettes[1], palettes[2], out + x);
+				x += count;
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+#if COROGB_SIMD_PIXELS
+	const uint32_t iterations = argc > 1 ? std::stoul(argv[1]) : 1000;
+	const inputs in = make_inputs();
+	bool all_match = true;
+
+	std::cout << std::fixed << std::setprecision(3);
+	all_match &= benchmark("apply_palette", iterations,
+		[&](std::vector<uint8_t>& screen)
+		{
+			for (size_t line = 0; line < line_count; ++line)
+			{
+				coro_gb::pixels::scalar::apply_palette(&in.colours[line * 168 + line % 8], 160, in.palettes[line], &screen[line * 160]);
+			}
+		},
+		[&](std::vector<uint8_t>& screen)
+		{
+			for (size_t line = 0; line < line_count; ++line)
+			{
+				coro_gb::pixels::simd::apply_palette(&in.colours[line * 168 + line % 8], 160, in.palettes[line], &screen[line * 160]);
+			}
+		});
+	all_match &= benchmark("compose", iterations,
+		[&](std::vector<uint8_t>& screen) { compose_lines(in, screen, coro_gb::pixels::scalar::compose); },
+		[&](std::vector<uint8_t>& screen) { compose_lines(in, screen, coro_gb::pixels::simd::compose); });
+	return all_match ? 0 : 1;
+#else
+	std::cerr << "built without the simd kernels, build with ssse3 or avx enabled\n";
+	return 2;
+#endif
+}
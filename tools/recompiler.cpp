@@ -0,0 +1,963 @@
+// recompiles a rom's code ahead of time to c++, for the cpu to run in place of interpreting it (see gb_recompiled.h)
+// code is found by following jumps and calls from the entry point, the interrupt vectors and any seed locations given,
+// through bank switches made with a constant bank number ("ld a,n / ld (2000),a")
+// seed files are anything listing "bank:address" locations, e.g. a .sym file, or the profiler report or call tree (F9) from a run,
+// or a .cov coverage file (F11), every instruction it recorded being run is a seed
+// add the output to the build, and it's used whenever the same rom is loaded
+//
+// usage: recompiler <rom> <output.cpp> [seed file]...
+// build: cl /std:c++20 /O2 /EHsc recompiler.cpp
+//    or: g++ -std=c++20 -O2 recompiler.cpp -o recompiler
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <regex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct location final
+	{
+		uint16_t bank;
+		uint16_t address;
+
+		friend auto operator<=>(const location&, const location&) = default;
+	};
+
+	// one instruction's code, as c++ running against a recompiled_context ("ctx") and its registers ("r")
+	struct instruction final
+	{
+		uint16_t address = 0;
+		uint8_t length = 1;
+		std::string code;
+		uint32_t cycles = 4; // the longest it can take, including the opcode fetch
+		bool push = false; // writes to the stack twice, see recompiled_context::begin_push()
+
+		// "$jump" in the code is replaced by a goto or an exit to target
+		std::optional<uint16_t> target;
+		bool call = false;
+		bool ends_block = false; // the code always exits
+		bool checks_rom_write = false; // writes to an address only known at runtime, which could switch rom banks
+		std::optional<uint16_t> rom_write; // writes to a constant rom address, i.e. an mbc register
+		bool writes_a = false;
+		std::optional<uint8_t> a_value; // A is this constant afterwards
+	};
+
+	std::string hex(uint32_t value, int digits)
+	{
+		char buffer[16];
+		std::snprintf(buffer, sizeof(buffer), "%0*X", digits, value);
+		return buffer;
+	}
+
+	std::string hex2(uint8_t value)
+	{
+		return "0x" + hex(value, 2);
+	}
+
+	std::string hex4(uint16_t value)
+	{
+		return "0x" + hex(value, 4);
+	}
+
+	// fnv-1a, must match hash_rom() in gb_recompiled.cpp
+	uint64_t hash_rom(const std::vector<uint8_t>& rom)
+	{
+		uint64_t hash = 0xCBF29CE484222325;
+		for (const uint8_t byte : rom)
+		{
+			hash = (hash ^ byte) * 0x100000001B3;
+		}
+		return hash;
+	}
+
+	const char* const r8[] = { "r.B", "r.C", "r.D", "r.E", "r.H", "r.L", nullptr, "r.A" };
+	const char* const r16[] = { "r.BC", "r.DE", "r.HL", "r.SP" };
+	const char* const r16_stack[] = { "r.BC", "r.DE", "r.HL", nullptr };
+	const char* const conditions[] = { "!ctx.flag_zero()", "ctx.flag_zero()", "!ctx.flag_carry()", "ctx.flag_carry()" };
+	const char* const alu_ops[] = { "add", "adc", "sub", "sbc", "logic_and", "logic_xor", "logic_or", "cp" };
+
+	// nullopt for instructions the interpreter has to run: halt, stop, and the unused opcodes
+	std::optional<instruction> recompile(uint16_t address, uint8_t opcode, uint8_t operand1, uint8_t operand2)
+	{
+		instruction ins;
+		ins.address = address;
+		const uint16_t operand16 = operand1 | operand2 << 8;
+		auto line = [&ins](const std::string& code) {
+			ins.code += code + "\n";
+		};
+
+		// ld r8,r8 / ld r8,(hl) / ld (hl),r8
+		if (opcode >= 0x40 && opcode <= 0x7F)
+		{
+			if (opcode == 0x76) // halt
+			{
+				return std::nullopt;
+			}
+			const uint8_t dest = (opcode >> 3) & 0b111;
+			const uint8_t source = opcode & 0b111;
+			if (source == 6)
+			{
+				line(std::string(r8[dest]) + " = ctx.read(r.HL);");
+				ins.cycles = 8;
+			}
+			else if (dest == 6)
+			{
+				line(std::string("ctx.write(r.HL, ") + r8[source] + ");");
+				ins.cycles = 8;
+				ins.checks_rom_write = true;
+			}
+			else if (dest != source)
+			{
+				line(std::string(r8[dest]) + " = " + r8[source] + ";");
+			}
+			ins.writes_a = dest == 7;
+			return ins;
+		}
+
+		// alu a,r8 / alu a,(hl)
+		if (opcode >= 0x80 && opcode <= 0xBF)
+		{
+			const uint8_t source = opcode & 0b111;
+			const std::string operation = alu_ops[(opcode >> 3) & 0b111];
+			if (source == 6)
+			{
+				line("ctx." + operation + "(ctx.read(r.HL));");
+				ins.cycles = 8;
+			}
+			else
+			{
+				line("ctx." + operation + "(" + r8[source] + ");");
+			}
+			ins.writes_a = opcode < 0xB8;
+			if (opcode == 0xAF) // xor a
+			{
+				ins.a_value = 0;
+			}
+			return ins;
+		}
+
+		if (opcode == 0xCB)
+		{
+			ins.length = 2;
+			const uint8_t target = operand1 & 0b111;
+			const uint8_t bit = (operand1 >> 3) & 0b111;
+			const std::string value = target == 6 ? "ctx.read(r.HL)" : r8[target];
+			line("ctx.idle_read();");
+			switch (operand1 >> 6)
+			{
+				case 0b00: // rotates/shifts
+					if (target == 6)
+					{
+						line("ctx.write(r.HL, ctx.shift(" + std::to_string(bit) + ", " + value + "));");
+					}
+					else
+					{
+						line(value + " = ctx.shift(" + std::to_string(bit) + ", " + value + ");");
+					}
+					break;
+				case 0b01: // bit test
+					line("ctx.bit(" + hex2(1 << bit) + ", " + value + ");");
+					break;
+				case 0b10: // bit reset
+					if (target == 6)
+					{
+						line("ctx.write(r.HL, " + value + " & " + hex2(~(1 << bit)) + ");");
+					}
+					else
+					{
+						line(value + " &= " + hex2(~(1 << bit)) + ";");
+					}
+					break;
+				case 0b11: // bit set
+					if (target == 6)
+					{
+						line("ctx.write(r.HL, " + value + " | " + hex2(1 << bit) + ");");
+					}
+					else
+					{
+						line(value + " |= " + hex2(1 << bit) + ";");
+					}
+					break;
+			}
+			ins.cycles = target != 6 ? 8 : (operand1 >> 6) == 0b01 ? 12 : 16;
+			ins.checks_rom_write = target == 6 && (operand1 >> 6) != 0b01;
+			ins.writes_a = target == 7 && (operand1 >> 6) != 0b01;
+			return ins;
+		}
+
+		const uint8_t column = (opcode >> 4) & 0b11;
+		switch (opcode)
+		{
+			case 0x00: // nop
+				return ins;
+
+			case 0x08: // ld (a16),sp
+				// the first write to an io register could start another unit before the second
+				if (operand16 >= 0xFE00)
+				{
+					return std::nullopt;
+				}
+				ins.length = 3;
+				ins.cycles = 20;
+				line("ctx.idle_read();");
+				line("ctx.idle_read();");
+				line("ctx.write(" + hex4(operand16) + ", r.SP & 0xFF);");
+				line("ctx.write(" + hex4(operand16 + 1) + ", r.SP >> 8);");
+				if (operand16 <= 0x7FFF)
+				{
+					ins.rom_write = operand16;
+				}
+				return ins;
+
+			case 0x01: case 0x11: case 0x21: case 0x31: // ld r16,d16
+				ins.length = 3;
+				ins.cycles = 12;
+				line("ctx.idle_read();");
+				line("ctx.idle_read();");
+				line(std::string(r16[column]) + " = " + hex4(operand16) + ";");
+				return ins;
+
+			case 0x09: case 0x19: case 0x29: case 0x39: // add hl,r16
+				ins.cycles = 8;
+				line(std::string("ctx.add_hl(") + r16[column] + ");");
+				return ins;
+
+			case 0x02: case 0x12: case 0x22: case 0x32: // ld (r16),a
+			{
+				const char* const addresses[] = { "r.BC", "r.DE", "r.HL++", "r.HL--" };
+				ins.cycles = 8;
+				ins.checks_rom_write = true;
+				line(std::string("ctx.write(") + addresses[column] + ", r.A);");
+				return ins;
+			}
+
+			case 0x0A: case 0x1A: case 0x2A: case 0x3A: // ld a,(r16)
+			{
+				const char* const addresses[] = { "r.BC", "r.DE", "r.HL++", "r.HL--" };
+				ins.cycles = 8;
+				ins.writes_a = true;
+				line(std::string("r.A = ctx.read(") + addresses[column] + ");");
+				return ins;
+			}
+
+			case 0x03: case 0x13: case 0x23: case 0x33: // inc r16
+				ins.cycles = 8;
+				line(std::string("++") + r16[column] + ";");
+				line("ctx.dummy(4);");
+				return ins;
+
+			case 0x0B: case 0x1B: case 0x2B: case 0x3B: // dec r16
+				ins.cycles = 8;
+				line(std::string("--") + r16[column] + ";");
+				line("ctx.dummy(4);");
+				return ins;
+
+			case 0x34: // inc (hl)
+			case 0x35: // dec (hl)
+				ins.cycles = 12;
+				ins.checks_rom_write = true;
+				line(std::string("ctx.write(r.HL, ctx.") + (opcode == 0x34 ? "inc" : "dec") + "(ctx.read(r.HL)));");
+				return ins;
+
+			case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: // inc r8
+			case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: // dec r8
+			{
+				const std::string reg = r8[(opcode >> 3) & 0b111];
+				line(reg + " = ctx." + ((opcode & 1) ? "dec" : "inc") + "(" + reg + ");");
+				ins.writes_a = opcode == 0x3C || opcode == 0x3D;
+				return ins;
+			}
+
+			case 0x36: // ld (hl),d8
+				ins.length = 2;
+				ins.cycles = 12;
+				ins.checks_rom_write = true;
+				line("ctx.idle_read();");
+				line("ctx.write(r.HL, " + hex2(operand1) + ");");
+				return ins;
+
+			case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // ld r8,d8
+				ins.length = 2;
+				ins.cycles = 8;
+				line("ctx.idle_read();");
+				line(std::string(r8[(opcode >> 3) & 0b111]) + " = " + hex2(operand1) + ";");
+				if (opcode == 0x3E)
+				{
+					ins.writes_a = true;
+					ins.a_value = operand1;
+				}
+				return ins;
+
+			case 0x07: case 0x0F: case 0x17: case 0x1F: // rlca/rrca/rla/rra
+				line("ctx.rotate_a(" + std::to_string(opcode >> 3) + ");");
+				ins.writes_a = true;
+				return ins;
+
+			case 0x27: // daa
+				line("ctx.daa();");
+				ins.writes_a = true;
+				return ins;
+
+			case 0x2F: // cpl
+				line("ctx.cpl();");
+				ins.writes_a = true;
+				return ins;
+
+			case 0x37: // scf
+				line("ctx.scf();");
+				return ins;
+
+			case 0x3F: // ccf
+				line("ctx.ccf();");
+				return ins;
+
+			case 0x18: // jr
+			case 0x20: case 0x28: case 0x30: case 0x38: // jr cc
+				ins.length = 2;
+				ins.cycles = 12;
+				ins.target = (uint16_t)(address + 2 + (int8_t)operand1);
+				line("ctx.idle_read();");
+				if (opcode == 0x18)
+				{
+					line("ctx.dummy(4);");
+					line("$jump");
+					ins.ends_block = true;
+				}
+				else
+				{
+					line(std::string("if (") + conditions[(opcode >> 3) & 0b11] + ")");
+					line("{");
+					line("\tctx.dummy(4);");
+					line("\t$jump");
+					line("}");
+				}
+				return ins;
+
+			case 0xC3: // jp
+			case 0xC2: case 0xCA: case 0xD2: case 0xDA: // jp cc
+				ins.length = 3;
+				ins.cycles = 16;
+				ins.target = operand16;
+				line("ctx.idle_read();");
+				line("ctx.idle_read();");
+				if (opcode == 0xC3)
+				{
+					line("ctx.dummy(4);");
+					line("$jump");
+					ins.ends_block = true;
+				}
+				else
+				{
+					line(std::string("if (") + conditions[(opcode >> 3) & 0b11] + ")");
+					line("{");
+					line("\tctx.dummy(4);");
+					line("\t$jump");
+					line("}");
+				}
+				return ins;
+
+			case 0xCD: // call
+			case 0xC4: case 0xCC: case 0xD4: case 0xDC: // call cc
+			{
+				ins.length = 3;
+				ins.cycles = 24;
+				ins.push = true;
+				ins.target = operand16;
+				ins.call = true;
+				const std::string call = "ctx.push(" + hex4(address + 3) + "); r.PC = " + hex4(operand16) + "; return true;";
+				line("ctx.idle_read();");
+				line("ctx.idle_read();");
+				if (opcode == 0xCD)
+				{
+					line(call);
+					ins.ends_block = true;
+				}
+				else
+				{
+					line(std::string("if (") + conditions[(opcode >> 3) & 0b11] + ")");
+					line("{");
+					line("\t" + call);
+					line("}");
+				}
+				return ins;
+			}
+
+			case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // rst
+				ins.cycles = 16;
+				ins.push = true;
+				ins.target = opcode & 0b00111000;
+				ins.call = true;
+				ins.ends_block = true;
+				line("ctx.push(" + hex4(address + 1) + ");");
+				line("r.PC = " + hex4(opcode & 0b00111000) + ";");
+				line("return true;");
+				return ins;
+
+			case 0xC9: // ret
+			case 0xD9: // reti
+				ins.cycles = 16;
+				ins.ends_block = true;
+				line("r.PC = ctx.pop();");
+				if (opcode == 0xD9)
+				{
+					line("r.enable_interrupts = true;");
+					line("r.enable_interrupts_delay = true;");
+				}
+				line("ctx.dummy(4);");
+				line("return true;");
+				return ins;
+
+			case 0xC0: case 0xC8: case 0xD0: case 0xD8: // ret cc
+				ins.cycles = 20;
+				line("ctx.dummy(4);");
+				line(std::string("if (") + conditions[(opcode >> 3) & 0b11] + ")");
+				line("{");
+				line("\tr.PC = ctx.pop();");
+				line("\tctx.dummy(4);");
+				line("\treturn true;");
+				line("}");
+				return ins;
+
+			case 0xC1: case 0xD1: case 0xE1: // pop
+				ins.cycles = 12;
+				line(std::string(r16_stack[column]) + " = ctx.pop();");
+				return ins;
+
+			case 0xF1: // pop af
+				ins.cycles = 12;
+				ins.writes_a = true;
+				line("ctx.set_af(ctx.pop());");
+				return ins;
+
+			case 0xC5: case 0xD5: case 0xE5: // push
+				ins.cycles = 16;
+				ins.push = true;
+				ins.checks_rom_write = true;
+				line(std::string("ctx.push(") + r16_stack[column] + ");");
+				return ins;
+
+			case 0xF5: // push af
+				ins.cycles = 16;
+				ins.push = true;
+				ins.checks_rom_write = true;
+				line("ctx.push(ctx.get_af());");
+				return ins;
+
+			case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // alu a,d8
+				ins.length = 2;
+				ins.cycles = 8;
+				ins.writes_a = opcode != 0xFE;
+				line("ctx.idle_read();");
+				line(std::string("ctx.") + alu_ops[(opcode >> 3) & 0b111] + "(" + hex2(operand1) + ");");
+				return ins;
+
+			case 0xE0: // ld (0xFF00 + a8),a
+				ins.length = 2;
+				ins.cycles = 12;
+				line("ctx.idle_read();");
+				line("ctx.write(" + hex4(0xFF00 + operand1) + ", r.A);");
+				return ins;
+
+			case 0xF0: // ld a,(0xFF00 + a8)
+				ins.length = 2;
+				ins.cycles = 12;
+				ins.writes_a = true;
+				line("ctx.idle_read();");
+				line("r.A = ctx.read(" + hex4(0xFF00 + operand1) + ");");
+				return ins;
+
+			case 0xE2: // ld (0xFF00 + c),a
+				ins.cycles = 8;
+				line("ctx.write(0xFF00 + r.C, r.A);");
+				return ins;
+
+			case 0xF2: // ld a,(0xFF00 + c)
+				ins.cycles = 8;
+				ins.writes_a = true;
+				line("r.A = ctx.read(0xFF00 + r.C);");
+				return ins;
+
+			case 0xEA: // ld (a16),a
+				ins.length = 3;
+				ins.cycles = 16;
+				line("ctx.idle_read();");
+				line("ctx.idle_read();");
+				line("ctx.write(" + hex4(operand16) + ", r.A);");
+				if (operand16 <= 0x7FFF)
+				{
+					ins.rom_write = operand16;
+				}
+				return ins;
+
+			case 0xFA: // ld a,(a16)
+				ins.length = 3;
+				ins.cycles = 16;
+				ins.writes_a = true;
+				line("ctx.idle_read();");
+				line("ctx.idle_read();");
+				line("r.A = ctx.read(" + hex4(operand16) + ");");
+				return ins;
+
+			case 0xE8: // add sp,e
+				ins.length = 2;
+				ins.cycles = 16;
+				line("ctx.idle_read();");
+				line("r.SP = ctx.add_sp(" + std::to_string((int8_t)operand1) + ");");
+				line("ctx.dummy(8);");
+				return ins;
+
+			case 0xF8: // ld hl,sp+e
+				ins.length = 2;
+				ins.cycles = 12;
+				line("ctx.idle_read();");
+				line("r.HL = ctx.add_sp(" + std::to_string((int8_t)operand1) + ");");
+				line("ctx.dummy(4);");
+				return ins;
+
+			case 0xE9: // jp hl
+				ins.ends_block = true;
+				line("r.PC = r.HL;");
+				line("return true;");
+				return ins;
+
+			case 0xF9: // ld sp,hl
+				ins.cycles = 8;
+				line("r.SP = r.HL;");
+				return ins;
+
+			case 0xF3: // di
+				line("r.enable_interrupts = false;");
+				line("r.enable_interrupts_delay = false;");
+				return ins;
+
+			case 0xFB: // ei
+				line("r.enable_interrupts_delay = true;");
+				return ins;
+		}
+
+		return std::nullopt;
+	}
+
+	struct block final
+	{
+		location start;
+		std::vector<instruction> instructions;
+		uint16_t end = 0; // address after the last instruction
+	};
+
+	struct recompiler final
+	{
+		recompiler(std::vector<uint8_t> in_rom)
+			: rom{ std::move(in_rom) }
+		{
+			// mbc5 is the only mbc where writing bank 0 maps bank 0
+			const uint8_t cartridge_type = rom[0x0147];
+			bank_zero_selectable = cartridge_type >= 0x19 && cartridge_type <= 0x1E;
+		}
+
+		void add_entry(location entry)
+		{
+			if (entry.address <= 0x7FFF && entry_bank_valid(entry))
+			{
+				worklist.push_back(entry);
+			}
+		}
+
+		void run()
+		{
+			while (!worklist.empty())
+			{
+				const location entry = worklist.front();
+				worklist.pop_front();
+				if (!covered.contains(entry))
+				{
+					recompile_block(entry);
+				}
+			}
+		}
+
+		void write(std::ostream& out, const std::string& rom_name) const
+		{
+			std::string title;
+			for (uint16_t address = 0x0134; address <= 0x0143 && rom[address] >= 0x20 && rom[address] < 0x7F; ++address)
+			{
+				if (rom[address] != '"' && rom[address] != '\\')
+				{
+					title += (char)rom[address];
+				}
+			}
+
+			out << "// recompiled from " << rom_name << " by tools/recompiler.cpp, do not edit\n";
+			out << "\n";
+			out << "#include \"gb_recompiled.h\"\n";
+			out << "\n";
+			out << "namespace\n";
+			out << "{\n";
+			out << "\tusing namespace coro_gb;\n";
+
+			for (const block& block : blocks)
+			{
+				write_block(out, block);
+			}
+
+			out << "\n";
+			out << "\tconst recompiled_block blocks[] =\n";
+			out << "\t{\n";
+			for (const block& block : blocks)
+			{
+				for (const instruction& ins : block.instructions)
+				{
+					out << "\t\t{ " << hex4(block.start.bank) << ", " << hex4(ins.address) << ", " << function_name(block.start) << " },\n";
+				}
+			}
+			out << "\t};\n";
+			out << "\n";
+			out << "\tconst recompiled_rom rom{ \"" << title << "\", 0x" << hex(hash_rom(rom) >> 32, 8) << hex((uint32_t)hash_rom(rom), 8) << ", blocks, std::size(blocks) };\n";
+			out << "\tconst recompiled_rom_registration registration{ rom };\n";
+			out << "}\n";
+		}
+
+		size_t get_block_count() const
+		{
+			return blocks.size();
+		}
+
+		size_t get_instruction_count() const
+		{
+			return covered.size();
+		}
+
+	protected:
+		static constexpr size_t max_block_instructions = 256;
+
+		uint16_t get_bank_count() const
+		{
+			return (uint16_t)std::max<size_t>(rom.size() / 0x4000, 2);
+		}
+
+		bool entry_bank_valid(location entry) const
+		{
+			return entry.address <= 0x3FFF ? entry.bank == 0 : entry.bank < get_bank_count();
+		}
+
+		uint8_t read(location at) const
+		{
+			const size_t offset = at.address <= 0x3FFF ? at.address : at.bank * 0x4000 + (at.address - 0x4000);
+			return offset < rom.size() ? rom[offset] : 0xFF;
+		}
+
+		void recompile_block(location entry)
+		{
+			block new_block{ entry, {} };
+			const uint16_t region_end = entry.address <= 0x3FFF ? 0x4000 : 0x8000;
+			const uint16_t region_bank = entry.address <= 0x3FFF ? 0 : entry.bank;
+
+			// the bank mapped at 0x4000-0x7FFF, if it's known
+			std::optional<uint16_t> switchable_bank;
+			if (entry.address >= 0x4000)
+			{
+				switchable_bank = entry.bank;
+			}
+			std::optional<uint8_t> a_value;
+
+			auto bank_of = [&](uint16_t target) -> std::optional<uint16_t> {
+				if (target <= 0x3FFF)
+				{
+					return 0;
+				}
+				return target <= 0x7FFF ? switchable_bank : std::nullopt;
+			};
+
+			uint32_t address = entry.address;
+			while (address < region_end && new_block.instructions.size() < max_block_instructions)
+			{
+				// join up with code that's already recompiled, rather than recompiling it again
+				if (address != entry.address && covered.contains({ region_bank, (uint16_t)address }))
+				{
+					break;
+				}
+
+				const location at{ region_bank, (uint16_t)address };
+				std::optional<instruction> ins = recompile(at.address,
+					read(at),
+					address + 1 < region_end ? read({ region_bank, (uint16_t)(address + 1) }) : 0,
+					address + 2 < region_end ? read({ region_bank, (uint16_t)(address + 2) }) : 0);
+				if (!ins || address + ins->length > region_end)
+				{
+					// continue after halt, and after stop's padding byte
+					const uint8_t opcode = read(at);
+					if (opcode == 0x76 || opcode == 0x10)
+					{
+						add_entry({ region_bank, (uint16_t)(address + (opcode == 0x10 ? 2 : 1)) });
+					}
+					break;
+				}
+
+				covered.insert(at);
+				const uint16_t next = (uint16_t)(address + ins->length);
+				if (ins->target)
+				{
+					if (const std::optional<uint16_t> target_bank = bank_of(*ins->target))
+					{
+						add_entry({ *target_bank, *ins->target });
+					}
+				}
+				// the code after a call is where it returns to, but not after rst, which is often used for jump tables (and is what 0xFF padding decodes as)
+				if (ins->call && ins->length == 3)
+				{
+					add_entry({ region_bank, next });
+				}
+
+				// follow bank switches made with a constant
+				if (ins->rom_write && *ins->rom_write >= 0x2000 && *ins->rom_write <= 0x3FFF)
+				{
+					switchable_bank.reset();
+					if (a_value)
+					{
+						uint16_t bank = *a_value % get_bank_count();
+						if (bank == 0 && !bank_zero_selectable)
+						{
+							bank = 1;
+						}
+						switchable_bank = bank;
+					}
+				}
+				if (ins->writes_a || ins->call)
+				{
+					a_value = ins->a_value;
+				}
+
+				const bool ends_block = ins->ends_block;
+				const bool rom_write = ins->rom_write.has_value();
+				new_block.instructions.push_back(std::move(*ins));
+				address = next;
+				if (ends_block)
+				{
+					break;
+				}
+				if (rom_write)
+				{
+					// the code after an mbc write might be in a different bank, so it's looked up again
+					add_entry({ region_bank, next });
+					break;
+				}
+			}
+
+			if (new_block.instructions.empty())
+			{
+				return;
+			}
+			new_block.end = (uint16_t)address;
+			if (address < region_end && !new_block.instructions.back().ends_block)
+			{
+				add_entry({ region_bank, (uint16_t)address });
+			}
+			blocks.push_back(std::move(new_block));
+		}
+
+		static std::string function_name(location at)
+		{
+			return "block_" + hex(at.bank, 2) + "_" + hex(at.address, 4);
+		}
+
+		static std::string label(uint16_t address)
+		{
+			return "a_" + hex(address, 4);
+		}
+
+		void write_block(std::ostream& out, const block& block) const
+		{
+			std::set<uint16_t> addresses;
+			for (const instruction& ins : block.instructions)
+			{
+				addresses.insert(ins.address);
+			}
+
+			out << "\n";
+			out << "\tbool " << function_name(block.start) << "(recompiled_context& ctx)\n";
+			out << "\t{\n";
+			out << "\t\tregisters_t& r = ctx.registers;\n";
+			out << "\t\tswitch (r.PC)\n";
+			out << "\t\t{\n";
+			for (const instruction& ins : block.instructions)
+			{
+				out << "\t\t\tcase " << hex4(ins.address) << ": goto " << label(ins.address) << ";\n";
+			}
+			out << "\t\t\tdefault: return false;\n";
+			out << "\t\t}\n";
+
+			for (const instruction& ins : block.instructions)
+			{
+				out << "\n";
+				out << "\t" << label(ins.address) << ":\n";
+				out << "\t\tif (!ctx." << (ins.push ? "begin_push" : "begin") << "(" << hex4(ins.address) << ", " << ins.cycles << "))\n";
+				out << "\t\t{\n";
+				out << "\t\t\treturn false;\n";
+				out << "\t\t}\n";
+
+				std::string code = ins.code;
+				if (const size_t jump = code.find("$jump"); jump != std::string::npos)
+				{
+					const std::string replacement = addresses.contains(*ins.target) ?
+						"goto " + label(*ins.target) + ";" :
+						"r.PC = " + hex4(*ins.target) + "; return true;";
+					code.replace(jump, 5, replacement);
+				}
+				for (size_t start = 0; start < code.size();)
+				{
+					const size_t end = code.find('\n', start);
+					out << "\t\t" << code.substr(start, end - start) << "\n";
+					start = end + 1;
+				}
+
+				const uint16_t next = (uint16_t)(ins.address + ins.length);
+				if (ins.checks_rom_write)
+				{
+					out << "\t\tif (ctx.take_rom_written())\n";
+					out << "\t\t{\n";
+					out << "\t\t\tr.PC = " << hex4(next) << ";\n";
+					out << "\t\t\treturn true;\n";
+					out << "\t\t}\n";
+				}
+			}
+
+			if (!block.instructions.back().ends_block)
+			{
+				out << "\n";
+				out << "\t\tr.PC = " << hex4(block.end) << ";\n";
+				out << "\t\treturn true;\n";
+			}
+			out << "\t}\n";
+		}
+
+		std::vector<uint8_t> rom;
+		bool bank_zero_selectable = false;
+		std::deque<location> worklist;
+		std::set<location> covered; // every instruction already recompiled
+		std::vector<block> blocks;
+	};
+
+	// a coverage file's header, must match coverage::save() in gb_coverage.cpp
+	// followed by the executed bitmap, a bit per rom byte
+	struct coverage_header final
+	{
+		char magic[8];
+		uint64_t rom_hash;
+		uint64_t rom_size;
+	};
+	constexpr char coverage_magic[8] = { 'C', 'G', 'B', 'C', 'O', 'V', '1', '\0' };
+
+	std::vector<location> read_coverage_seeds(const std::string& data, const std::vector<uint8_t>& rom, const char* path)
+	{
+		coverage_header header;
+		std::memcpy(&header, data.data(), sizeof(header));
+		if (header.rom_hash != hash_rom(rom) || header.rom_size != rom.size() || data.size() < sizeof(header) + (rom.size() + 7) / 8)
+		{
+			throw std::runtime_error(std::string(path) + " is coverage of a different rom");
+		}
+
+		std::vector<location> seeds;
+		const uint8_t* executed = reinterpret_cast<const uint8_t*>(data.data() + sizeof(header));
+		for (size_t offset = 0; offset < rom.size(); ++offset)
+		{
+			if ((executed[offset >> 3] >> (offset & 7)) & 1)
+			{
+				const uint16_t bank = (uint16_t)(offset / 0x4000);
+				seeds.push_back({ bank, (uint16_t)(bank == 0 ? offset : 0x4000 | (offset & 0x3FFF)) });
+			}
+		}
+		return seeds;
+	}
+
+	// "bank:address" locations, as in .sym files and profiler output, or a coverage file
+	std::vector<location> read_seeds(const char* path, const std::vector<uint8_t>& rom)
+	{
+		std::ifstream file{ path, std::ios::binary };
+		if (!file)
+		{
+			throw std::runtime_error(std::string("couldn't open ") + path);
+		}
+
+		std::string text{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+		if (text.size() >= sizeof(coverage_header) && std::memcmp(text.data(), coverage_magic, sizeof(coverage_magic)) == 0)
+		{
+			return read_coverage_seeds(text, rom, path);
+		}
+
+		std::vector<location> seeds;
+		const std::regex pattern{ "\\b([0-9A-Fa-f]{1,4}):([0-9A-Fa-f]{4})\\b" };
+		for (auto match = std::sregex_iterator(text.begin(), text.end(), pattern); match != std::sregex_iterator(); ++match)
+		{
+			seeds.push_back({ (uint16_t)std::stoul((*match)[1], nullptr, 16), (uint16_t)std::stoul((*match)[2], nullptr, 16) });
+		}
+		return seeds;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "usage: recompiler <rom> <output.cpp> [seed file]...\n";
+		return 2;
+	}
+
+	try
+	{
+		std::ifstream rom_file{ argv[1], std::ios::binary };
+		if (!rom_file)
+		{
+			throw std::runtime_error(std::string("couldn't open ") + argv[1]);
+		}
+		std::vector<uint8_t> rom{ std::istreambuf_iterator<char>(rom_file), std::istreambuf_iterator<char>() };
+		if (rom.size() < 0x8000)
+		{
+			throw std::runtime_error("rom is too small");
+		}
+
+		std::vector<location> seeds;
+		for (int i = 3; i < argc; ++i)
+		{
+			const std::vector<location> file_seeds = read_seeds(argv[i], rom);
+			seeds.insert(seeds.end(), file_seeds.begin(), file_seeds.end());
+		}
+
+		recompiler recompiler{ std::move(rom) };
+		recompiler.add_entry({ 0, 0x0100 });
+		for (uint16_t vector = 0x00; vector <= 0x60; vector += 8)
+		{
+			recompiler.add_entry({ 0, vector });
+		}
+		for (const location seed : seeds)
+		{
+			recompiler.add_entry(seed);
+		}
+		recompiler.run();
+
+		std::ofstream out{ argv[2] };
+		if (!out)
+		{
+			throw std::runtime_error(std::string("couldn't open ") + argv[2]);
+		}
+		recompiler.write(out, std::filesystem::path(argv[1]).filename().string());
+		std::cout << recompiler.get_block_count() << " blocks, " << recompiler.get_instruction_count() << " instructions\n";
+		return 0;
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << ex.what() << '\n';
+		return 2;
+	}
+}
@@ -0,0 +1,163 @@
+// finds the first instruction where two gameboy-doctor style traces diverge
+// e.g. a CoroGB trace (F10) against one from a reference emulator, either can be plain text or lz4 compressed
+//
+// usage: trace_diff <trace> <reference trace> [lines of context]
+// build: cl /std:c++20 /O2 /EHsc /I.. trace_diff.cpp ../gb_lz4.cpp
+//    or: g++ -std=c++20 -O2 -I.. trace_diff.cpp ../gb_lz4.cpp -o trace_diff
+
+#include "gb_lz4.h"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct trace_reader final
+	{
+		trace_reader(const char* path)
+			: file{ path, std::ios::binary }
+		{
+			if (!file)
+			{
+				throw std::runtime_error(std::string("couldn't open ") + path);
+			}
+			if (coro_gb::lz4::is_frame(file))
+			{
+				decompressor.emplace(file);
+			}
+		}
+
+		bool getline(std::string& line)
+		{
+			line.clear();
+			while (true)
+			{
+				if (position == buffer.size())
+				{
+					if (!refill())
+					{
+						return !line.empty();
+					}
+				}
+
+				const uint8_t* start = buffer.data() + position;
+				const uint8_t* end = buffer.data() + buffer.size();
+				const uint8_t* newline = std::find(start, end, '\n');
+				line.append(start, newline);
+				position = newline - buffer.data();
+				if (newline != end)
+				{
+					++position;
+					if (!line.empty() && line.back() == '\r')
+					{
+						line.pop_back();
+					}
+					return true;
+				}
+			}
+		}
+
+	protected:
+		bool refill()
+		{
+			position = 0;
+			if (decompressor)
+			{
+				return decompressor->read(buffer);
+			}
+			buffer.resize(1024 * 1024);
+			file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+			buffer.resize(file.gcount());
+			return !buffer.empty();
+		}
+
+		std::ifstream file;
+		std::optional<coro_gb::lz4::frame_reader> decompressor;
+		std::vector<uint8_t> buffer;
+		size_t position = 0;
+	};
+
+	// the names of the "NAME:VALUE" fields that differ
+	std::string differing_fields(const std::string& line, const std::string& reference)
+	{
+		std::istringstream line_fields{ line };
+		std::istringstream reference_fields{ reference };
+		std::string field;
+		std::string reference_field;
+		std::string differences;
+		while (line_fields >> field && reference_fields >> reference_field)
+		{
+			if (field != reference_field)
+			{
+				differences += ' ' + reference_field.substr(0, reference_field.find(':'));
+			}
+		}
+		return differences;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "usage: trace_diff <trace> <reference trace> [lines of context]\n";
+		return 2;
+	}
+
+	try
+	{
+		trace_reader trace{ argv[1] };
+		trace_reader reference{ argv[2] };
+		const size_t context_lines = argc > 3 ? std::stoul(argv[3]) : 10;
+
+		std::deque<std::string> context;
+		std::string line;
+		std::string reference_line;
+		for (uint64_t line_number = 1;; ++line_number)
+		{
+			const bool has_line = trace.getline(line);
+			const bool has_reference_line = reference.getline(reference_line);
+			if (!has_line && !has_reference_line)
+			{
+				std::cout << "traces match (" << line_number - 1 << " instructions)\n";
+				return 0;
+			}
+
+			if (has_line != has_reference_line || line != reference_line)
+			{
+				std::cout << "first divergence at instruction " << line_number << ":\n";
+				for (const std::string& previous : context)
+				{
+					std::cout << "  " << previous << '\n';
+				}
+				std::cout << "- " << (has_reference_line ? reference_line : "<end of reference trace>") << '\n';
+				std::cout << "+ " << (has_line ? line : "<end of trace>") << '\n';
+				if (has_line && has_reference_line)
+				{
+					std::cout << "differs in:" << differing_fields(line, reference_line) << '\n';
+				}
+				return 1;
+			}
+
+			if (context_lines > 0)
+			{
+				if (context.size() == context_lines)
+				{
+					context.pop_front();
+				}
+				context.push_back(line);
+			}
+		}
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << ex.what() << '\n';
+		return 2;
+	}
+}
@@ -14,6 +14,7 @@
 #include <cassert>
 #include <codecvt>
 #include <filesystem>
+#include <fstream>
 #include <functional>
 #include <optional>
 
@@ -135,7 +136,8 @@ int APIENTRY wWinMain(
 			TranslateMessage(&msg);
 			DispatchMessage(&msg);
 
-			if (emu_instance)
+			// once stopped, nothing happens until input() delivers a button, so there's nothing to tick until then
+			if (emu_instance && !emu_instance->is_stopped())
 			{
 				while (!PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE))
 				{
@@ -162,7 +164,23 @@ int APIENTRY wWinMain(
 					if (elapsed_time_in_cycles >= coro_gb::cycles(5 * 456))
 					{
 						// tick at most 10 lines (4560 cycles) or we might miss the vsync
-						emu_instance->tick(10 * 456);
+						const coro_gb::tick_result result = emu_instance->tick(10 * 456);
+						if (result == coro_gb::tick_result::stopped)
+						{
+							// the cpu just stopped, blank the screen once and block in GetMessage until a key is pressed
+							InvalidateRect(main_window, nullptr, FALSE);
+							sync_time = now_time;
+							sync_cycles = emu_instance->get_cycle_counter();
+							break;
+						}
+#if _DEBUG
+						if (result == coro_gb::tick_result::breakpoint)
+						{
+							// breakpoints can be set from the debugger with emu_instance->add_pc_breakpoint() etc
+							[[maybe_unused]] const coro_gb::break_info hit = emu_instance->take_break();
+							__debugbreak();
+						}
+#endif
 					}
 					else
 					{
@@ -442,6 +460,73 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT Message, WPARAM wParam, LPARAM lParam)
 						emu_instance->input(coro_gb::button_id::start, coro_gb::button_state::down);
 						return 0;
 					}
+					if (wParam == VK_F9)
+					{
+						// toggle the guest profiler, results are written next to the rom when it's stopped
+						coro_gb::profiler& profiler = emu_instance->get_profiler();
+						if (!profiler.is_running())
+						{
+							profiler.load_symbols(std::filesystem::path{ current_rom }.replace_extension(".sym"));
+							emu_instance->start_profiler(1024);
+						}
+						else
+						{
+							profiler.stop();
+							std::ofstream flat_profile{ std::filesystem::path{ current_rom }.replace_extension(".profile.txt") };
+							profiler.write_flat_profile(flat_profile);
+							std::ofstream collapsed_stacks{ std::filesystem::path{ current_rom }.replace_extension(".folded") };
+							profiler.write_collapsed_stacks(collapsed_stacks);
+#if COROGB_CALL_PROFILER
+							std::ofstream call_tree{ std::filesystem::path{ current_rom }.replace_extension(".calls.txt") };
+							profiler.write_call_tree(call_tree);
+#endif
+							profiler.clear();
+						}
+						return 0;
+					}
+					if (wParam == VK_F10)
+					{
+						// toggle the instruction trace, written next to the rom
+						if (!emu_instance->is_tracing())
+						{
+							emu_instance->start_trace(std::filesystem::path{ current_rom }.replace_extension(".trace.lz4"));
+						}
+						else
+						{
+							emu_instance->stop_trace();
+						}
+						return 0;
+					}
+#if COROGB_OPCODE_STATS
+					if (wParam == VK_F8)
+					{
+						// toggle counting opcodes and waits, written next to the rom when stopped
+						if (!emu_instance->is_counting_opcodes())
+						{
+							emu_instance->start_opcode_stats();
+						}
+						else
+						{
+							std::ofstream report{ std::filesystem::path{ current_rom }.replace_extension(".opcodes.txt") };
+							emu_instance->stop_opcode_stats(report);
+						}
+						return 0;
+					}
+#endif
+					if (wParam == VK_F11)
+					{
+						// toggle coverage recording, merged into the .cov next to the rom from earlier runs
+						if (!emu_instance->is_recording_coverage())
+						{
+							emu_instance->start_coverage();
+						}
+						else
+						{
+							std::ofstream report{ std::filesystem::path{ current_rom }.replace_extension(".cov.txt") };
+							emu_instance->stop_coverage(std::filesystem::path{ current_rom }.replace_extension(".cov"), report);
+						}
+						return 0;
+					}
 				}
 			}
 			if (wParam == VK_ADD)